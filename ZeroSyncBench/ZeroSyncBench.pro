@@ -0,0 +1,65 @@
+#-------------------------------------------------
+#
+# Scanner benchmark, builds the scanner sources of the client
+#
+#-------------------------------------------------
+
+QT       += core\
+            sql
+
+QT       -= gui
+
+# Same Qt requirement as the client, see ZeroSyncDesktop.pro
+lessThan(QT_MAJOR_VERSION, 5)|if(equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 9)) {
+    error("Qt 5.9 or newer is required")
+}
+
+TARGET = ZeroSyncBench
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+
+CLIENT = ../ZeroSyncDesktop
+
+INCLUDEPATH += $$CLIENT
+DEPENDPATH += $$CLIENT
+
+SOURCES += main.cpp \
+    zstreegenerator.cpp \
+    zsscannerbenchmark.cpp \
+    $$CLIENT/zsfilesystemwatcher.cpp \
+    $$CLIENT/zsdatabase.cpp \
+    $$CLIENT/zsindex.cpp \
+    $$CLIENT/zsfilemetadata.cpp \
+    $$CLIENT/zssettings.cpp \
+    $$CLIENT/zseventcoalescer.cpp \
+    $$CLIENT/zsdirectorywalker.cpp \
+    $$CLIENT/zschunker.cpp \
+    $$CLIENT/zssha3.cpp \
+    $$CLIENT/zsfilehasher.cpp \
+    $$CLIENT/zsexpectedwrites.cpp
+
+HEADERS  += zstreegenerator.h \
+    zsscannerbenchmark.h \
+    $$CLIENT/zsfilesystemwatcher.h \
+    $$CLIENT/zsdatabase.h \
+    $$CLIENT/zsindex.h \
+    $$CLIENT/zsfilemetadata.h \
+    $$CLIENT/zssettings.h \
+    $$CLIENT/zseventcoalescer.h \
+    $$CLIENT/zsdirectorywalker.h \
+    $$CLIENT/zschunker.h \
+    $$CLIENT/zssha3.h \
+    $$CLIENT/zsfilehasher.h \
+    $$CLIENT/zsexpectedwrites.h
+
+linux {
+    SOURCES += $$CLIENT/zsinotify.cpp
+    HEADERS += $$CLIENT/zsinotify.h
+}
+
+RESOURCES += \
+    $$CLIENT/ZeroSyncResources.qrc
+
+QMAKE_CXXFLAGS += -std=c++11
@@ -0,0 +1,113 @@
+/* =========================================================================
+   Main - Entry point of the ZeroSync scanner benchmark
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zstreegenerator.h"
+#include "zsscannerbenchmark.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QDir>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    // Own name, so database and settings do not touch the ones of the client
+    a.setApplicationName("ZeroSyncBench");
+    a.setOrganizationName("ZeroSyncTeam");
+    a.setOrganizationDomain("zerosync.org");
+    a.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("ZeroSync scanner benchmark");
+    parser.addHelpOption();
+    QCommandLineOption filesOption("files", "Number of files to generate.", "count", "10000");
+    QCommandLineOption depthOption("depth", "Maximum directory depth.", "levels", "4");
+    QCommandLineOption fanoutOption("fanout", "Subdirectories per directory.", "count", "8");
+    QCommandLineOption minimumSizeOption("min-size", "Smallest file size in bytes.", "bytes", "1024");
+    QCommandLineOption maximumSizeOption("max-size", "Largest file size in bytes.", "bytes", "1048576");
+    QCommandLineOption distributionOption("distribution", "File size distribution, uniform or loguniform.", "name", "loguniform");
+    QCommandLineOption duplicatesOption("duplicates", "Share of files with the content of another file.", "ratio", "0.1");
+    QCommandLineOption seedOption("seed", "Seed of the tree generator.", "number", "1");
+    QCommandLineOption renamesOption("renames", "Number of files renamed at once.", "count", "0");
+    QCommandLineOption coalesceOption("coalesce-window", "Quiet window of the event coalescer in milliseconds.", "ms", "100");
+    QCommandLineOption directoryOption("directory", "Generate the tree in this empty directory instead of a temporary one.", "path");
+    parser.addOption(filesOption);
+    parser.addOption(depthOption);
+    parser.addOption(fanoutOption);
+    parser.addOption(minimumSizeOption);
+    parser.addOption(maximumSizeOption);
+    parser.addOption(distributionOption);
+    parser.addOption(duplicatesOption);
+    parser.addOption(seedOption);
+    parser.addOption(renamesOption);
+    parser.addOption(coalesceOption);
+    parser.addOption(directoryOption);
+    parser.process(a);
+
+    QTextStream out(stdout);
+    QTemporaryDir temporaryDirectory;
+    QString pathToDirectory = parser.isSet(directoryOption) ? QDir(parser.value(directoryOption)).absolutePath() : temporaryDirectory.path();
+    if(!QDir().mkpath(pathToDirectory) || !QDir(pathToDirectory).entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty())
+    {
+        out << "Directory " << pathToDirectory << " has to be empty\n";
+        return 1;
+    }
+
+    // Every run starts from an empty database
+    QFile::remove(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/zsdatabase.sqlite");
+    ZSDatabase::getInstance();
+    ZSSettings::getInstance()->setZeroSyncDirectory(pathToDirectory);
+    ZSSettings::getInstance()->setCoalesceWindow(parser.value(coalesceOption).toInt());
+
+    ZSTreeGenerator treeGenerator;
+    treeGenerator.setFileCount(parser.value(filesOption).toInt());
+    treeGenerator.setDepth(parser.value(depthOption).toInt());
+    treeGenerator.setFanout(parser.value(fanoutOption).toInt());
+    treeGenerator.setSizeRange(parser.value(minimumSizeOption).toLongLong(), parser.value(maximumSizeOption).toLongLong());
+    treeGenerator.setSizeDistribution(parser.value(distributionOption) == "uniform" ? ZSTreeGenerator::Uniform : ZSTreeGenerator::LogUniform);
+    treeGenerator.setDuplicateRatio(parser.value(duplicatesOption).toDouble());
+    treeGenerator.setSeed(parser.value(seedOption).toULongLong());
+    out << "Generating " << parser.value(filesOption) << " files in " << pathToDirectory << "\n";
+    out.flush();
+    if(!treeGenerator.generate(pathToDirectory))
+    {
+        return 1;
+    }
+    out << "Generated " << treeGenerator.getTotalBytes() / 1000000.0 << " MB\n\n";
+
+    ZSScannerBenchmark benchmark(0, pathToDirectory, treeGenerator.getFiles());
+    if(parser.value(renamesOption).toInt() > 0)
+    {
+        benchmark.setRenameCount(parser.value(renamesOption).toInt());
+    }
+    benchmark.run();
+    benchmark.printReport(out);
+
+    ZSDatabase::deleteInstance();
+    return benchmark.passed() ? 0 : 1;
+}
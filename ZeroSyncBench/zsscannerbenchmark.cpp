@@ -0,0 +1,268 @@
+/* =========================================================================
+   ZSScannerBenchmark - Measures the scanner end to end through the database
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsscannerbenchmark.h"
+
+
+ZSScannerBenchmark::ZSScannerBenchmark(QObject *parent, QString pathToDirectory, QStringList files) :
+    QObject(parent),
+    pathToDirectory(pathToDirectory),
+    files(files),
+    renameCount(qMin(1000, qMax(files.size() / 10, 1))),
+    settleTime(2000),
+    timeout(60000),
+    fileSystemWatcher(0),
+    hashedBytesAtStart(0),
+    databaseOperationsAtStart(0),
+    pollOperations(0),
+    changedTimestamp(0)
+{
+}
+
+
+ZSScannerBenchmark::~ZSScannerBenchmark()
+{
+    stopWatcher();
+}
+
+
+void ZSScannerBenchmark::setRenameCount(int count)
+{
+    renameCount = qBound(1, count, files.size());
+}
+
+
+void ZSScannerBenchmark::setSettleTime(int milliseconds)
+{
+    settleTime = milliseconds;
+}
+
+
+void ZSScannerBenchmark::setTimeout(int milliseconds)
+{
+    timeout = milliseconds;
+}
+
+
+void ZSScannerBenchmark::run()
+{
+    runColdScan();
+    runRescan("warm rescan", true);
+    runRescan("full rescan", false);
+    runSingleFileChange();
+    runMassRename();
+    stopWatcher();
+}
+
+
+void ZSScannerBenchmark::runColdScan()
+{
+    beginMeasurement();
+    startWatcher();
+    endMeasurement("cold scan", files.size(), true);
+}
+
+
+void ZSScannerBenchmark::runRescan(QString scenario, bool cleanShutdown)
+{
+    // Restarts like the application, with or without the clean shutdown marker
+    stopWatcher();
+    ZSDatabase::getInstance()->setCleanShutdown(cleanShutdown);
+    beginMeasurement();
+    startWatcher();
+    endMeasurement(scenario, files.size(), true);
+}
+
+
+void ZSScannerBenchmark::runSingleFileChange()
+{
+    settle();
+    changedFile = files.at(files.size() / 2);
+    QString path = pathToDirectory + "/" + changedFile;
+
+    beginMeasurement();
+    QFile file(path);
+    if(!file.open(QFile::Append))
+    {
+        qDebug() << "Error - ZSScannerBenchmark::runSingleFileChange() failed to open " << path;
+        endMeasurement("single file change", 1, false);
+        return;
+    }
+    file.write(QByteArray(4096, 'z'));
+    file.close();
+    changedTimestamp = QFileInfo(path).lastModified().toUTC().toMSecsSinceEpoch();
+    bool recorded = waitFor(&ZSScannerBenchmark::isChangeRecorded);
+    endMeasurement("single file change", 1, recorded);
+}
+
+
+void ZSScannerBenchmark::runMassRename()
+{
+    settle();
+    renamedFrom.clear();
+    renamedTo.clear();
+    int step = qMax(files.size() / renameCount, 1);
+    for(int i = 0; i < files.size() && renamedFrom.size() < renameCount; i += step)
+    {
+        renamedFrom.append(files.at(i));
+        renamedTo.append(QString(files.at(i)).replace(".dat", ".renamed.dat"));
+    }
+
+    beginMeasurement();
+    for(int i = 0; i < renamedFrom.size(); i++)
+    {
+        QFile::rename(pathToDirectory + "/" + renamedFrom.at(i), pathToDirectory + "/" + renamedTo.at(i));
+    }
+    bool recorded = waitFor(&ZSScannerBenchmark::isRenameRecorded);
+
+    // Events are handled in order, the remaining renames are only verified
+    for(int i = 0; recorded && i < renamedFrom.size(); i++)
+    {
+        pollOperations += 2;
+        recorded = ZSDatabase::getInstance()->existsFileEntry(renamedTo.at(i)) &&
+                ZSDatabase::getInstance()->isFileRenamed(renamedFrom.at(i));
+    }
+    endMeasurement("mass rename", renamedFrom.size(), recorded);
+}
+
+
+void ZSScannerBenchmark::startWatcher()
+{
+    fileSystemWatcher = new ZSFileSystemWatcher();
+    fileSystemWatcher->setZeroSyncDirectory(pathToDirectory);
+}
+
+
+void ZSScannerBenchmark::stopWatcher()
+{
+    delete fileSystemWatcher;
+    fileSystemWatcher = 0;
+}
+
+
+void ZSScannerBenchmark::settle()
+{
+    // The watcher thread registers its watches in the background after a start
+    QElapsedTimer waited;
+    waited.start();
+    while(waited.elapsed() < settleTime)
+    {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        QThread::msleep(10);
+    }
+}
+
+
+void ZSScannerBenchmark::beginMeasurement()
+{
+    pollOperations = 0;
+    hashedBytesAtStart = ZSFileHasher::getHashedBytes();
+    databaseOperationsAtStart = ZSDatabase::getInstance()->getOperationCount();
+    timer.start();
+}
+
+
+void ZSScannerBenchmark::endMeasurement(QString scenario, int files, bool passed)
+{
+    ZSBenchmarkResult result;
+    result.scenario = scenario;
+    result.files = files;
+    result.elapsed = timer.elapsed();
+    result.hashedBytes = ZSFileHasher::getHashedBytes() - hashedBytesAtStart;
+    // Polls of the benchmark itself are not part of the scanner's work
+    result.databaseOperations = ZSDatabase::getInstance()->getOperationCount() - databaseOperationsAtStart - pollOperations;
+    result.passed = passed;
+    results.append(result);
+    if(!passed)
+    {
+        qDebug() << "Error - ZSScannerBenchmark::endMeasurement(): Scenario" << scenario << "did not complete";
+    }
+}
+
+
+bool ZSScannerBenchmark::waitFor(bool (ZSScannerBenchmark::*condition)())
+{
+    QElapsedTimer waited;
+    waited.start();
+    while(!(this->*condition)())
+    {
+        if(waited.elapsed() > timeout)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        QThread::msleep(1);
+    }
+    return true;
+}
+
+
+bool ZSScannerBenchmark::isChangeRecorded()
+{
+    pollOperations++;
+    return ZSDatabase::getInstance()->getTimestampForFile(changedFile) == changedTimestamp;
+}
+
+
+bool ZSScannerBenchmark::isRenameRecorded()
+{
+    pollOperations += 2;
+    return ZSDatabase::getInstance()->existsFileEntry(renamedTo.last()) &&
+            ZSDatabase::getInstance()->isFileRenamed(renamedFrom.last());
+}
+
+
+void ZSScannerBenchmark::printReport(QTextStream &out)
+{
+    out << QString("%1 %2 %3 %4 %5 %6\n")
+           .arg("scenario", -20).arg("files", 9).arg("ms", 9)
+           .arg("files/s", 12).arg("MB/s hashed", 12).arg("db ops/file", 12);
+    foreach(const ZSBenchmarkResult &result, results)
+    {
+        double seconds = qMax(result.elapsed, Q_INT64_C(1)) / 1000.0;
+        out << QString("%1 %2 %3 %4 %5 %6%7\n")
+               .arg(result.scenario, -20)
+               .arg(result.files, 9)
+               .arg(result.elapsed, 9)
+               .arg(result.files / seconds, 12, 'f', 1)
+               .arg(result.hashedBytes / 1000000.0 / seconds, 12, 'f', 2)
+               .arg((double) result.databaseOperations / qMax(result.files, 1), 12, 'f', 2)
+               .arg(result.passed ? "" : "  FAILED");
+    }
+    out.flush();
+}
+
+
+bool ZSScannerBenchmark::passed()
+{
+    foreach(const ZSBenchmarkResult &result, results)
+    {
+        if(!result.passed)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+/* =========================================================================
+   ZSScannerBenchmark - Measures the scanner end to end through the database
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSSCANNERBENCHMARK_H
+#define ZSSCANNERBENCHMARK_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QThread>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QStringList>
+#include <QList>
+#include <QtDebug>
+#include "zsfilesystemwatcher.h"
+#include "zsfilehasher.h"
+#include "zsdatabase.h"
+#include "zssettings.h"
+
+
+//!  Result of a benchmark scenario
+struct ZSBenchmarkResult
+{
+    QString scenario;
+    int files;
+    qint64 elapsed;
+    qint64 hashedBytes;
+    quint64 databaseOperations;
+    bool passed;
+};
+
+
+//!  Class that benchmarks the filesystem scanner
+/*!
+  This class runs the scanner scenarios against a generated tree: a cold scan into
+  an empty database, rescans of an unchanged tree after a clean shutdown and after
+  a crash, the handling of a single changed file and of a mass rename. Every
+  scenario goes through ZSFileSystemWatcher and ZSDatabase like the application does.
+*/
+class ZSScannerBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSScannerBenchmark(QObject *parent = 0, QString pathToDirectory = QString(), QStringList files = QStringList());
+    ~ZSScannerBenchmark();
+
+    void setRenameCount(int);
+    void setSettleTime(int);
+    void setTimeout(int);
+
+    //!  Run-Method
+    /*!
+      Runs all scenarios in order, each one building on the state the previous left.
+    */
+    void run();
+
+    //!  PrintReport-Method
+    /*!
+      Prints files/s, MB/s hashed and database operations per file for every scenario.
+    */
+    void printReport(QTextStream &);
+    bool passed();
+
+private:
+    QString pathToDirectory;
+    QStringList files;
+    int renameCount;
+    int settleTime;
+    int timeout;
+    ZSFileSystemWatcher *fileSystemWatcher;
+    QList<ZSBenchmarkResult> results;
+
+    QElapsedTimer timer;
+    qint64 hashedBytesAtStart;
+    quint64 databaseOperationsAtStart;
+    quint64 pollOperations;
+
+    void runColdScan();
+    void runRescan(QString, bool);
+    void runSingleFileChange();
+    void runMassRename();
+
+    void startWatcher();
+    void stopWatcher();
+    void settle();
+    void beginMeasurement();
+    void endMeasurement(QString, int, bool);
+    bool waitFor(bool (ZSScannerBenchmark::*)());
+    bool isChangeRecorded();
+    bool isRenameRecorded();
+
+    QString changedFile;
+    qint64 changedTimestamp;
+    QStringList renamedFrom;
+    QStringList renamedTo;
+};
+
+#endif // ZSSCANNERBENCHMARK_H
@@ -0,0 +1,200 @@
+/* =========================================================================
+   ZSTreeGenerator - Generates synthetic directory trees for benchmarks
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zstreegenerator.h"
+
+#include <cmath>
+
+
+ZSTreeGenerator::ZSTreeGenerator(QObject *parent) :
+    QObject(parent),
+    fileCount(10000),
+    depth(4),
+    fanout(8),
+    minimumSize(1024),
+    maximumSize(1024 * 1024),
+    sizeDistribution(LogUniform),
+    duplicateRatio(0.1),
+    random(1),
+    totalBytes(0)
+{
+}
+
+
+void ZSTreeGenerator::setFileCount(int count)
+{
+    fileCount = qMax(count, 1);
+}
+
+
+void ZSTreeGenerator::setDepth(int levels)
+{
+    depth = qMax(levels, 0);
+}
+
+
+void ZSTreeGenerator::setFanout(int directories)
+{
+    fanout = qMax(directories, 1);
+}
+
+
+void ZSTreeGenerator::setSizeRange(qint64 minimum, qint64 maximum)
+{
+    minimumSize = qMax(minimum, Q_INT64_C(0));
+    maximumSize = qMax(maximum, minimumSize);
+}
+
+
+void ZSTreeGenerator::setSizeDistribution(SizeDistribution distribution)
+{
+    sizeDistribution = distribution;
+}
+
+
+void ZSTreeGenerator::setDuplicateRatio(double ratio)
+{
+    duplicateRatio = qBound(0.0, ratio, 1.0);
+}
+
+
+void ZSTreeGenerator::setSeed(quint64 seed)
+{
+    random.seed(seed);
+}
+
+
+bool ZSTreeGenerator::generate(QString pathToDirectory)
+{
+    files.clear();
+    totalBytes = 0;
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    for(int i = 0; i < fileCount; i++)
+    {
+        QString directory = randomDirectory();
+        QString file = directory.isEmpty() ? QString("f%1.dat").arg(i) : QString("%1/f%2.dat").arg(directory, QString::number(i));
+        QString path = pathToDirectory + "/" + file;
+        if(!QDir(pathToDirectory).mkpath(directory.isEmpty() ? QString(".") : directory))
+        {
+            qDebug() << "Error - ZSTreeGenerator::generate() failed to create directory " << directory;
+            return false;
+        }
+
+        if(!files.isEmpty() && chance(random) < duplicateRatio)
+        {
+            // Copies the content of an earlier file, like a backup or a checked out branch
+            std::uniform_int_distribution<int> pick(0, files.size() - 1);
+            QString original = pathToDirectory + "/" + files.at(pick(random));
+            if(!QFile::copy(original, path))
+            {
+                qDebug() << "Error - ZSTreeGenerator::generate() failed to copy " << original;
+                return false;
+            }
+            totalBytes += QFileInfo(path).size();
+        }
+        else
+        {
+            qint64 size = randomSize();
+            if(!writeRandomFile(path, size))
+            {
+                return false;
+            }
+            totalBytes += size;
+        }
+        files.append(file);
+    }
+    return true;
+}
+
+
+QStringList ZSTreeGenerator::getFiles()
+{
+    return files;
+}
+
+
+qint64 ZSTreeGenerator::getTotalBytes()
+{
+    return totalBytes;
+}
+
+
+QString ZSTreeGenerator::randomDirectory()
+{
+    std::uniform_int_distribution<int> levels(0, depth);
+    std::uniform_int_distribution<int> branch(0, fanout - 1);
+    QStringList directories;
+    for(int level = levels(random); level > 0; level--)
+    {
+        directories.append(QString("d%1").arg(branch(random)));
+    }
+    return directories.join("/");
+}
+
+
+qint64 ZSTreeGenerator::randomSize()
+{
+    if(sizeDistribution == Uniform || minimumSize == maximumSize)
+    {
+        std::uniform_int_distribution<qint64> size(minimumSize, maximumSize);
+        return size(random);
+    }
+
+    // Many small and few large files, like most real directory trees
+    std::uniform_real_distribution<double> exponent(std::log(minimumSize + 1.0), std::log(maximumSize + 1.0));
+    return qBound(minimumSize, (qint64) std::exp(exponent(random)) - 1, maximumSize);
+}
+
+
+bool ZSTreeGenerator::writeRandomFile(QString path, qint64 size)
+{
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        qDebug() << "Error - ZSTreeGenerator::writeRandomFile() failed to open " << path;
+        return false;
+    }
+
+    QByteArray buffer;
+    while(size > 0)
+    {
+        int length = (int) qMin(size, Q_INT64_C(1024 * 1024));
+        buffer.resize((length + 7) & ~7);
+        quint64 *words = reinterpret_cast<quint64 *>(buffer.data());
+        for(int i = 0; i < buffer.size() / 8; i++)
+        {
+            words[i] = random();
+        }
+        if(file.write(buffer.constData(), length) != length)
+        {
+            qDebug() << "Error - ZSTreeGenerator::writeRandomFile() failed to write " << path;
+            return false;
+        }
+        size -= length;
+    }
+    file.close();
+    return true;
+}
@@ -0,0 +1,103 @@
+/* =========================================================================
+   ZSTreeGenerator - Generates synthetic directory trees for benchmarks
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSTREEGENERATOR_H
+#define ZSTREEGENERATOR_H
+
+#include <QObject>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QByteArray>
+#include <QtDebug>
+#include <random>
+
+
+//!  Class that generates synthetic directory trees
+/*!
+  This class fills a directory with a reproducible tree of files. The number of
+  files, the depth and fanout of the directories, the distribution of the file
+  sizes and the share of files with duplicate content can be configured.
+*/
+class ZSTreeGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Distribution the file sizes are drawn from
+    enum SizeDistribution
+    {
+        Uniform,
+        LogUniform
+    };
+
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSTreeGenerator(QObject *parent = 0);
+
+    void setFileCount(int);
+    void setDepth(int);
+    void setFanout(int);
+    void setSizeRange(qint64, qint64);
+    void setSizeDistribution(SizeDistribution);
+    void setDuplicateRatio(double);
+    void setSeed(quint64);
+
+    //!  Generate-Method
+    /*!
+      Creates the tree below the given directory. Returns false if a file could not
+      be written.
+    */
+    bool generate(QString pathToDirectory);
+
+    //!  GetFiles-Method
+    /*!
+      Returns the paths of the generated files relative to the directory.
+    */
+    QStringList getFiles();
+    qint64 getTotalBytes();
+
+private:
+    int fileCount;
+    int depth;
+    int fanout;
+    qint64 minimumSize;
+    qint64 maximumSize;
+    SizeDistribution sizeDistribution;
+    double duplicateRatio;
+    std::mt19937_64 random;
+
+    QStringList files;
+    qint64 totalBytes;
+
+    QString randomDirectory();
+    qint64 randomSize();
+    bool writeRandomFile(QString, qint64);
+};
+
+#endif // ZSTREEGENERATOR_H
@@ -9,6 +9,11 @@ QT       += core gui\
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+# Checksums are SHA3-512 of FIPS 202, older Qt versions compute Keccak for QCryptographicHash::Sha3_512
+lessThan(QT_MAJOR_VERSION, 5)|if(equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 9)) {
+    error("Qt 5.9 or newer is required")
+}
+
 TARGET = ZeroSyncDesktop
 TEMPLATE = app
 
@@ -29,7 +34,19 @@ SOURCES += main.cpp\
     zshtmlbuilder.cpp \
     zsinotify.cpp \
     zsconsolewindow.cpp \
-    zswebsocketserver.cpp
+    zswebsocketserver.cpp \
+    zseventcoalescer.cpp \
+    zsdirectorywalker.cpp \
+    zschunker.cpp \
+    zssha3.cpp \
+    zsfilehasher.cpp \
+    zsexpectedwrites.cpp \
+    zsfilehandlecache.cpp \
+    zsstagingarea.cpp \
+    zstransferscheduler.cpp \
+    zschunkcodec.cpp \
+    zsfilepack.cpp \
+    zsconnectorworker.cpp
 
 HEADERS  += mainwindow.h \
     zsfilesystemwatcher.h \
@@ -45,7 +62,19 @@ HEADERS  += mainwindow.h \
     zshtmlbuilder.h \
     zsinotify.h \
     zsconsolewindow.h \
-    zswebsocketserver.h
+    zswebsocketserver.h \
+    zseventcoalescer.h \
+    zsdirectorywalker.h \
+    zschunker.h \
+    zssha3.h \
+    zsfilehasher.h \
+    zsexpectedwrites.h \
+    zsfilehandlecache.h \
+    zsstagingarea.h \
+    zstransferscheduler.h \
+    zschunkcodec.h \
+    zsfilepack.h \
+    zsconnectorworker.h
 
 FORMS    += mainwindow.ui
 
@@ -74,6 +74,8 @@ void MainWindow::establishUiConnections()
     connect(fileSystemWatcher, SIGNAL(signalDirectoryChangeRecognized(QString)), htmlBuilder, SLOT(slotGenerateHtml()));
     connect(fileSystemWatcher, SIGNAL(signalFileChangeRecognized(QString)), htmlBuilder, SLOT(slotGenerateHtml()));
     connect(index, SIGNAL(signalIndexUpdated(int)), connector, SLOT(slotSynchronizeUpdate(int)));
+    connect(fileSystemWatcher, SIGNAL(signalChangesSettled()), index, SLOT(slotChangesSettled()));
+    connect(fileSystemWatcher, SIGNAL(signalFileChangeRecognized(QString)), connector, SLOT(slotFileChanged(QString)));
     connect(htmlTrayMenuAction, SIGNAL(triggered()), this, SLOT(slotOpenZeroWebIndex()));
 }
 
@@ -95,7 +97,7 @@ void MainWindow::slotSaveSettings()
             if(ZSSettings::getInstance()->getSyncInterval() > 0)
             {
                 index->slotUpdateIndex();
-                timer->start(ZSSettings::getInstance()->getSyncInterval());
+                timer->start(ZSIndex::getSafetyNetInterval());
             }
             qDebug() << "Information - MainWindow::slotSaveSettings() - Synchronization interval changed: " << ui->sliderSyncInterval->value();
         }
@@ -210,10 +212,11 @@ void MainWindow::slotWizardFinished()
     timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), index, SLOT(slotUpdateIndex()));
 
+    // Changes are published when they settle, the timer only catches what no signal reported
     if(ZSSettings::getInstance()->getSyncInterval() > 0)
     {
         index->slotUpdateIndex();
-        timer->start(ZSSettings::getInstance()->getSyncInterval());
+        timer->start(ZSIndex::getSafetyNetInterval());
     }
     gotWindowsMinimizedThisSession = false;
 
@@ -0,0 +1,7 @@
+CREATE TABLE IF NOT EXISTS chunks (
+    path TEXT NOT NULL,
+    offset INTEGER NOT NULL,
+    length INTEGER NOT NULL,
+    checksum TEXT NOT NULL,
+    PRIMARY KEY (path, offset)
+);
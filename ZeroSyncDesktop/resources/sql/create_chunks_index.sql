@@ -0,0 +1 @@
+CREATE INDEX IF NOT EXISTS chunks_checksum ON chunks (checksum);
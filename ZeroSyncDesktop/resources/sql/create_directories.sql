@@ -0,0 +1,7 @@
+CREATE TABLE IF NOT EXISTS directories (
+    path TEXT NOT NULL,
+    mtime INTEGER NOT NULL,
+    scanned INTEGER NOT NULL,
+    generation INTEGER NOT NULL,
+    PRIMARY KEY (path)
+);
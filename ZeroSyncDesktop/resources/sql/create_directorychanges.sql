@@ -0,0 +1,6 @@
+CREATE TABLE IF NOT EXISTS directorychanges (
+    path TEXT NOT NULL,
+    newpath TEXT,
+    operation TEXT NOT NULL,
+    timestamp INTEGER NOT NULL
+);
@@ -0,0 +1 @@
+CREATE INDEX IF NOT EXISTS fileindex_path ON fileindex (path, state);
@@ -10,5 +10,7 @@ CREATE TABLE files (
     reference INTEGER NOT NULL,
     deleted INTEGER NOT NULL,
     changed_self INTEGER NOT NULL,
+    generation INTEGER NOT NULL DEFAULT 0,
+    appended INTEGER NOT NULL DEFAULT 0,
     PRIMARY KEY (path)
 );
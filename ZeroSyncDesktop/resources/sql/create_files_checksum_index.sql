@@ -0,0 +1 @@
+CREATE INDEX IF NOT EXISTS files_checksum ON files (checksum);
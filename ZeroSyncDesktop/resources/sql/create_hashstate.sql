@@ -0,0 +1,7 @@
+CREATE TABLE IF NOT EXISTS hashstate (
+    path TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    fingerprint TEXT NOT NULL,
+    state BLOB NOT NULL,
+    PRIMARY KEY (path)
+);
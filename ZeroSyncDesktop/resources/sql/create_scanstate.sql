@@ -0,0 +1,5 @@
+CREATE TABLE IF NOT EXISTS scanstate (
+    key TEXT NOT NULL,
+    value INTEGER NOT NULL,
+    PRIMARY KEY (key)
+);
@@ -0,0 +1,8 @@
+CREATE TABLE IF NOT EXISTS transfers (
+    path TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    checksum TEXT NOT NULL,
+    ranges BLOB NOT NULL,
+    updated INTEGER NOT NULL,
+    PRIMARY KEY (path)
+);
@@ -0,0 +1,192 @@
+/* =========================================================================
+   ZSChunkCodec - Compresses chunks on the wire
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zschunkcodec.h"
+
+#include <QFileInfo>
+#include <time.h>
+#include <string.h>
+
+static const quint32 FRAME_MAGIC = 0x5a534331;     // "ZSC1"
+
+// Compression saves bandwidth, which is scarcer than CPU between the sites
+static const int COMPRESSION_LEVEL = 6;
+
+// A sample that does not shrink to this share of its size marks the file as incompressible
+static const double SAMPLE_RATIO = 0.9;
+
+static const int MAXIMUM_SAMPLED_PATHS = 4096;
+
+
+ZSChunkCodec::ZSChunkCodec(QObject *parent) :
+    QObject(parent)
+{
+}
+
+
+QByteArray ZSChunkCodec::encode(QString peer, QString path, const char *data, qint64 length, qint64 offset)
+{
+    qint64 cpuTime = threadCpuTime();
+    QByteArray payload;
+    quint8 codec = Raw;
+    if(isWorthCompressing(path, data, length, offset))
+    {
+        payload = qCompress((const uchar *) data, length, COMPRESSION_LEVEL);
+        if(payload.size() < length)
+        {
+            codec = Zlib;
+        }
+    }
+    if(codec == Raw)
+    {
+        payload = QByteArray::fromRawData(data, length);
+    }
+
+    QByteArray frame(HEADER_SIZE + payload.size(), Qt::Uninitialized);
+    uchar *header = (uchar *) frame.data();
+    qToBigEndian<quint32>(FRAME_MAGIC, header);
+    header[4] = codec;
+    header[5] = header[6] = header[7] = 0;
+    qToBigEndian<quint32>(length, header + 8);
+    qToBigEndian<quint64>(offset, header + 12);
+    memcpy(frame.data() + HEADER_SIZE, payload.constData(), payload.size());
+
+    count(peer, codec != Raw, length, frame.size(), threadCpuTime() - cpuTime);
+    return frame;
+}
+
+
+bool ZSChunkCodec::decode(QString peer, const char *data, qint64 length, QByteArray &content, qint64 &offset)
+{
+    const uchar *header = (const uchar *) data;
+    if(length < HEADER_SIZE || qFromBigEndian<quint32>(header) != FRAME_MAGIC)
+    {
+        // A peer that sends unframed chunks has compression disabled
+        qDebug() << "Error - ZSChunkCodec::decode() failed: Chunk of" << length << "bytes is not a frame";
+        return false;
+    }
+
+    qint64 cpuTime = threadCpuTime();
+    quint8 codec = header[4];
+    qint64 contentLength = qFromBigEndian<quint32>(header + 8);
+    offset = qFromBigEndian<quint64>(header + 12);
+    if(codec == Zlib)
+    {
+        content = qUncompress(header + HEADER_SIZE, length - HEADER_SIZE);
+    }
+    else
+    if(codec == Raw)
+    {
+        content = QByteArray(data + HEADER_SIZE, length - HEADER_SIZE);
+    }
+    else
+    {
+        qDebug() << "Error - ZSChunkCodec::decode() failed: Unknown codec" << codec;
+        return false;
+    }
+    if(content.size() != contentLength)
+    {
+        qDebug() << "Error - ZSChunkCodec::decode() failed: Frame holds" << content.size() << "instead of" << contentLength << "bytes";
+        return false;
+    }
+
+    count(peer, codec != Raw, contentLength, length, threadCpuTime() - cpuTime);
+    return true;
+}
+
+
+bool ZSChunkCodec::isCompressible(QString path)
+{
+    static QSet<QString> compressedTypes = QSet<QString>()
+            << "7z" << "apk" << "avi" << "bz2" << "docx" << "epub" << "flac" << "gif" << "gz"
+            << "heic" << "jar" << "jpeg" << "jpg" << "m4a" << "m4v" << "mkv" << "mov" << "mp3"
+            << "mp4" << "odp" << "ods" << "odt" << "ogg" << "opus" << "pdf" << "png" << "pptx"
+            << "rar" << "tgz" << "webm" << "webp" << "xlsx" << "xz" << "zip" << "zst";
+    return !compressedTypes.contains(QFileInfo(path).suffix().toLower());
+}
+
+
+void ZSChunkCodec::forget(QString path)
+{
+    QMutexLocker locker(&mutex);
+    sampledPaths.remove(path);
+}
+
+
+QHash<QString, ZSCompressionStatistics> ZSChunkCodec::getStatistics()
+{
+    QMutexLocker locker(&mutex);
+    return statistics;
+}
+
+
+bool ZSChunkCodec::isWorthCompressing(QString path, const char *data, qint64 length, qint64 offset)
+{
+    if(!isCompressible(path))
+    {
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    QHash<QString, bool>::const_iterator sampled = sampledPaths.constFind(path);
+    if(sampled != sampledPaths.constEnd())
+    {
+        return sampled.value();
+    }
+    // The sample of the first chunk decides for the whole file
+    locker.unlock();
+    qint64 sampleLength = qMin(length, (qint64) SAMPLE_SIZE);
+    bool worth = sampleLength > 0 && qCompress((const uchar *) data, sampleLength, 1).size() < sampleLength * SAMPLE_RATIO;
+    locker.relock();
+    if(sampledPaths.size() >= MAXIMUM_SAMPLED_PATHS)
+    {
+        sampledPaths.clear();
+    }
+    if(offset == 0 || !worth)
+    {
+        sampledPaths.insert(path, worth);
+    }
+    return worth;
+}
+
+
+void ZSChunkCodec::count(QString peer, bool compressed, qint64 rawBytes, qint64 wireBytes, qint64 cpuTime)
+{
+    QMutexLocker locker(&mutex);
+    ZSCompressionStatistics &peerStatistics = statistics[peer];
+    peerStatistics.chunks++;
+    peerStatistics.compressedChunks += compressed ? 1 : 0;
+    peerStatistics.rawBytes += rawBytes;
+    peerStatistics.wireBytes += wireBytes;
+    peerStatistics.cpuTime += cpuTime;
+}
+
+
+qint64 ZSChunkCodec::threadCpuTime()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return (qint64) time.tv_sec * 1000000000 + time.tv_nsec;
+}
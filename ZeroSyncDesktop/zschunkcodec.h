@@ -0,0 +1,121 @@
+/* =========================================================================
+   ZSChunkCodec - Compresses chunks on the wire
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSCHUNKCODEC_H
+#define ZSCHUNKCODEC_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QtDebug>
+
+
+//!  Compression counters of one peer
+struct ZSCompressionStatistics
+{
+    qint64 chunks;
+    qint64 compressedChunks;
+    qint64 rawBytes;
+    qint64 wireBytes;
+    qint64 cpuTime;         // Nanoseconds spent compressing or decompressing
+};
+
+
+//!  Class that compresses chunks on the wire
+/*!
+  Chunks are sent in a frame that names the codec, the length of the content and
+  its offset in the file. Content is compressed with zlib through qCompress, but
+  not for file types that are compressed already, not for files whose first chunk
+  compressed poorly in a sample and not when the result would not be smaller.
+  With compression enabled in the settings every chunk is sent in a frame, raw
+  content included, and every received chunk has to be one; with it disabled
+  chunks are neither framed nor decoded. The content of a chunk is never guessed to
+  be a frame, so all peers need the same setting. Ratio and CPU time are counted
+  per peer.
+*/
+class ZSChunkCodec : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Codec
+    {
+        Raw = 0,
+        Zlib = 1
+    };
+
+    static const int HEADER_SIZE = 20;
+    static const int SAMPLE_SIZE = 16 * 1024;
+
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSChunkCodec(QObject *parent = 0);
+
+    //!  Encode-Method
+    /*!
+      Returns the frame of the content of the path at offset, compressed if worth it.
+      The peer is only used for the statistics.
+    */
+    QByteArray encode(QString peer, QString path, const char *data, qint64 length, qint64 offset);
+
+    //!  Decode-Method
+    /*!
+      Restores the content of a frame and its offset in the file. Returns false if the
+      data is not a frame or the frame is corrupt.
+    */
+    bool decode(QString peer, const char *data, qint64 length, QByteArray &content, qint64 &offset);
+
+    //!  IsCompressible-Method
+    /*!
+      Returns false for file types that are compressed already.
+    */
+    static bool isCompressible(QString path);
+
+    //!  Forget-Method
+    /*!
+      Drops the sampled decision for the path, e.g. after it changed.
+    */
+    void forget(QString path);
+
+    QHash<QString, ZSCompressionStatistics> getStatistics();
+
+private:
+    QMutex mutex;
+    QHash<QString, bool> sampledPaths;
+    QHash<QString, ZSCompressionStatistics> statistics;
+
+    bool isWorthCompressing(QString path, const char *data, qint64 length, qint64 offset);
+    void count(QString peer, bool compressed, qint64 rawBytes, qint64 wireBytes, qint64 cpuTime);
+    static qint64 threadCpuTime();
+};
+
+#endif // ZSCHUNKCODEC_H
@@ -0,0 +1,130 @@
+/* =========================================================================
+   ZSChunker - Content-defined chunking of file content
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zschunker.h"
+
+// Masks with more bits set cut less often, below the average size the stricter one is used
+static const quint64 MASK_SMALL = ~Q_UINT64_C(0) << (64 - 18);
+static const quint64 MASK_LARGE = ~Q_UINT64_C(0) << (64 - 14);
+
+// Random values per byte, generated with splitmix64 from a fixed seed, so every peer cuts alike
+static const quint64 *gearTable()
+{
+    static quint64 table[256];
+    static bool initialized = false;
+    if(!initialized)
+    {
+        quint64 state = Q_UINT64_C(0x5a65726f53796e63);
+        for(int i = 0; i < 256; i++)
+        {
+            quint64 value = (state += Q_UINT64_C(0x9e3779b97f4a7c15));
+            value = (value ^ (value >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+            value = (value ^ (value >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+            table[i] = value ^ (value >> 31);
+        }
+        initialized = true;
+    }
+    return table;
+}
+
+static const quint64 *GEAR = gearTable();
+
+
+ZSChunker::ZSChunker(QObject *parent) :
+    QObject(parent),
+    chunkHash(QCryptographicHash::Sha256),
+    fingerprint(0),
+    chunkOffset(0),
+    chunkLength(0)
+{
+}
+
+
+void ZSChunker::setOffset(qint64 offset)
+{
+    chunkHash.reset();
+    chunkOffset = offset;
+    chunkLength = 0;
+    fingerprint = 0;
+}
+
+
+void ZSChunker::addData(const char *data, qint64 length)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    qint64 start = 0;
+    qint64 position = 0;
+    while(position < length)
+    {
+        // The minimum size is skipped without rolling, no cut can happen there anyway
+        if(chunkLength < MINIMUM_SIZE)
+        {
+            qint64 skip = qMin(MINIMUM_SIZE - chunkLength, length - position);
+            chunkLength += skip;
+            position += skip;
+            continue;
+        }
+
+        fingerprint = (fingerprint << 1) + GEAR[bytes[position]];
+        chunkLength++;
+        position++;
+        quint64 mask = chunkLength < AVERAGE_SIZE ? MASK_SMALL : MASK_LARGE;
+        if((fingerprint & mask) == 0 || chunkLength >= MAXIMUM_SIZE)
+        {
+            chunkHash.addData(data + start, position - start);
+            start = position;
+            endChunk();
+        }
+    }
+    chunkHash.addData(data + start, length - start);
+}
+
+
+QList<ZSChunk> ZSChunker::takeChunks()
+{
+    if(chunkLength > 0)
+    {
+        endChunk();
+    }
+    QList<ZSChunk> result = chunks;
+    chunks.clear();
+    chunkOffset = 0;
+    return result;
+}
+
+
+void ZSChunker::endChunk()
+{
+    ZSChunk chunk;
+    chunk.offset = chunkOffset;
+    chunk.length = chunkLength;
+    chunk.hash = chunkHash.result().toHex();
+    chunks.append(chunk);
+
+    chunkHash.reset();
+    chunkOffset += chunkLength;
+    chunkLength = 0;
+    fingerprint = 0;
+}
@@ -0,0 +1,100 @@
+/* =========================================================================
+   ZSChunker - Content-defined chunking of file content
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSCHUNKER_H
+#define ZSCHUNKER_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QCryptographicHash>
+
+
+//!  Content-defined chunk of a file
+/*!
+  Region of a file whose boundaries depend only on the content around them, so
+  an insertion or deletion shifts the following chunks instead of changing them.
+*/
+struct ZSChunk
+{
+    qint64 offset;
+    qint64 length;
+    QString hash;
+};
+
+
+//!  Class that splits a byte stream into content-defined chunks
+/*!
+  This class implements FastCDC: a gear hash rolls over the content and a chunk
+  ends where the hash matches a mask. The first bytes of every chunk are skipped,
+  a stricter mask is used below and a looser one above the average size, which
+  keeps the chunk sizes close to the average. The content is fed in arbitrary
+  pieces, so the chunks are found in the same pass that hashes the whole file.
+*/
+class ZSChunker : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint64 MINIMUM_SIZE = 16 * 1024;
+    static const qint64 AVERAGE_SIZE = 64 * 1024;
+    static const qint64 MAXIMUM_SIZE = 256 * 1024;
+
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSChunker(QObject *parent = 0);
+
+    //!  SetOffset-Method
+    /*!
+      Starts the next chunk at the given offset of the file, e.g. to continue chunking
+      from the start of the last chunk of a file that grew.
+    */
+    void setOffset(qint64 offset);
+
+    //!  AddData-Method
+    /*!
+      Feeds the next piece of the content.
+    */
+    void addData(const char *data, qint64 length);
+
+    //!  TakeChunks-Method
+    /*!
+      Ends the last chunk and returns all chunks. The chunker starts over afterwards.
+    */
+    QList<ZSChunk> takeChunks();
+
+private:
+    QList<ZSChunk> chunks;
+    QCryptographicHash chunkHash;
+    quint64 fingerprint;
+    qint64 chunkOffset;
+    qint64 chunkLength;
+
+    void endChunk();
+};
+
+#endif // ZSCHUNKER_H
@@ -25,11 +25,28 @@
 #include "zsconnector.h"
 
 zsync_agent_t * ZSConnector::agent;
+ZSFileHandleCache * ZSConnector::fileHandleCache;
+ZSStagingArea * ZSConnector::stagingArea;
+ZSTransferScheduler * ZSConnector::transferScheduler;
+ZSChunkCodec * ZSConnector::chunkCodec;
+ZSFilePack * ZSConnector::filePack;
+ZSConnectorWorker * ZSConnector::worker;
+int ZSConnector::directoryDescriptor = -1;
+QString ZSConnector::directoryPath;
 
 ZSConnector::ZSConnector(QObject *parent) :
     QObject(parent)
 {
+    // Created first, so it is destroyed and stopped before the objects its jobs use
+    ZSConnector::worker = new ZSConnectorWorker(this);
+    ZSConnector::worker->start();
+    ZSConnector::fileHandleCache = new ZSFileHandleCache(this);
+    ZSConnector::stagingArea = new ZSStagingArea(this);
+    ZSConnector::stagingArea->restoreTransfers();
+    ZSConnector::chunkCodec = new ZSChunkCodec(this);
+    ZSConnector::filePack = new ZSFilePack(ZSConnector::stagingArea, this);
     ZSConnector::agent = zsync_agent_new();
+    ZSConnector::transferScheduler = new ZSTransferScheduler(ZSConnector::agent, ZSConnector::stagingArea, ZSConnector::filePack, this);
     zsync_agent_set_get_update(ZSConnector::agent, (void *) &ZSConnector::get_update);
     zsync_agent_set_pass_update(ZSConnector::agent, (void *) &ZSConnector::pass_update);
 
@@ -41,119 +58,414 @@ ZSConnector::ZSConnector(QObject *parent) :
     qDebug() << zsync_agent_start(ZSConnector::agent);
 }
 
+ZSConnector::~ZSConnector()
+{
+    zsync_agent_stop(ZSConnector::agent);
+    // Jobs still queued are applied, their requests go to the scheduler that is deleted next
+    delete ZSConnector::worker;
+    ZSConnector::worker = 0;
+    delete ZSConnector::transferScheduler;
+    ZSConnector::transferScheduler = 0;
+    zsync_agent_destroy(&ZSConnector::agent);
+}
+
 
 zlist_t* ZSConnector::get_update(uint64_t from_state)
 {
     qDebug() << "get_update";
-    QSqlQuery query = ZSDatabase::getInstance()->fetchUpdateFromState(from_state);
-
     zlist_t *updateList = zlist_new();
-    while (query.next()) {
-        zs_fmetadata_t *fmetadata = zs_fmetadata_new();
-        zs_fmetadata_set_path(fmetadata, "%s", query.value(1).toString().toUtf8().data());
-        zs_fmetadata_set_timestamp(fmetadata, query.value(3).toULongLong());
-        QString op = query.value(2).toString();
-        if (op.compare("UPD") == 0) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_UPD);
-            zs_fmetadata_set_size(fmetadata, query.value(4).toULongLong());
-            zs_fmetadata_set_checksum(fmetadata, query.value(6).toULongLong());
-        }
-        else
-        if (op.compare("REN") == 0 ) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_REN);
-            zs_fmetadata_set_renamed_path(fmetadata, "%", query.value(5).toString().toUtf8().data());
-        }
-        else
-        if (op.compare("DEL") == 0) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_DEL);
+
+    // Pages end at the state the request came in with, entries indexed meanwhile follow with the next update
+    int toState = ZSDatabase::getInstance()->getLatestState();
+    int afterState = from_state;
+    qint64 afterRow = 0;
+    int count;
+    do {
+        QSqlQuery query = ZSDatabase::getInstance()->fetchNetUpdatePage(from_state, toState, afterState, afterRow, UPDATE_PAGE_SIZE);
+        count = 0;
+        while (query.next()) {
+            zlist_append(updateList, createMetadata(query));
+            afterState = query.value(0).toInt();
+            afterRow = query.value(7).toLongLong();
+            count++;
         }
-        zlist_append(updateList, fmetadata);
+    } while (count == UPDATE_PAGE_SIZE);
+
+    if (zlist_size(updateList) == 0) {
+        zlist_destroy(&updateList);
     }
-    return zlist_size(updateList) > 0 ? updateList : NULL;
+    return updateList;
 }
 
 void ZSConnector::pass_update(char* sender, zlist_t* file_metadata)
 {
     qDebug() << "pass_update";
-    zlist_t *requestList = zlist_new();
-    uint64_t requestBytes = 0;
+    // The list belongs to the agent, its entries are copied for the worker
+    ZSConnectorJob *job = new ZSConnectorJob();
+    job->type = ZSConnectorJob::Update;
+    job->sender = QString::fromUtf8(sender);
     zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_first(file_metadata);
     while(fmetadata) {
-        QString path = QString(zs_fmetadata_path(fmetadata));
-        QSqlQuery query = ZSDatabase::getInstance()->fetchFileByPath(path);
+        ZSUpdateEntry entry;
+        entry.operation = zs_fmetadata_operation(fmetadata);
+        entry.path = QString::fromUtf8(zs_fmetadata_path(fmetadata));
+        entry.size = 0;
+        entry.checksum = 0;
+        entry.timestamp = zs_fmetadata_timestamp(fmetadata);
+        if (entry.operation == ZS_FILE_OP_UPD) {
+            entry.size = zs_fmetadata_size(fmetadata);
+            entry.checksum = zs_fmetadata_checksum(fmetadata);
+        }
+        else if (entry.operation == ZS_FILE_OP_REN) {
+            entry.renamedPath = QString::fromUtf8(zs_fmetadata_renamed_path(fmetadata));
+        }
+        job->entries.append(entry);
+        fmetadata = (zs_fmetadata_t *) zlist_next(file_metadata);
+    }
+    worker->post(job);
+}
+
+void ZSConnector::process(ZSConnectorJob &job)
+{
+    if (job.type == ZSConnectorJob::Update) {
+        applyUpdate(job.sender, job.entries);
+    }
+    else if (job.type == ZSConnectorJob::Chunk) {
+        applyChunk(job.path, job.offset, job.data);
+    }
+}
+
+void ZSConnector::applyUpdate(QString peer, const QList<ZSUpdateEntry> &entries)
+{
+    int directory = openSyncDirectory();
+    foreach (const ZSUpdateEntry &entry, entries) {
+        if (entry.path.endsWith('/')) {
+            applyDirectoryUpdate(directory, entry);
+            continue;
+        }
+        QSqlQuery query = ZSDatabase::getInstance()->fetchFileByPath(entry.path);
         uint64_t timestamp = 0;
         if (query.next()) {
            timestamp = query.value(1).toULongLong();
         }
+        // NOTE: newest file always wins == no merging
+        if (timestamp > entry.timestamp) {
+            continue;
+        }
+        QByteArray path = QFile::encodeName(entry.path);
+        struct stat status;
 
-        switch(zs_fmetadata_operation(fmetadata)) {
+        switch(entry.operation) {
         case ZS_FILE_OP_UPD:
-            // Add to request list if local file is older
-            // NOTE: newest file always wins == no merging
-            if (timestamp <= zs_fmetadata_timestamp (fmetadata)) {
-                zlist_append(requestList, zs_fmetadata_path(fmetadata));
-                requestBytes += zs_fmetadata_size (fmetadata);
+            // Content that exists locally is copied, only misses go over the network
+            if (!stagingArea->copyLocalFile(entry.path, entry.size, entry.checksum)) {
+                transferScheduler->enqueue(peer, entry.path, entry.size, entry.checksum, entry.timestamp);
             }
             break;
         case ZS_FILE_OP_REN:
-            if (timestamp <= zs_fmetadata_timestamp (fmetadata)) {
-                // move file to new location. EXCLUDE FROM UPDATE
-                QFile file(zs_fmetadata_path(fmetadata));
-                QDir::setCurrent(ZSSettings::getInstance()->getZeroSyncDirectory());
-                if (file.exists()) {
-                    file.rename(zs_fmetadata_renamed_path(fmetadata));
-                    ZSDatabase::getInstance()->setFileChangedSelf(zs_fmetadata_path(fmetadata), 1);
+            // move file to new location. EXCLUDE FROM UPDATE
+            if (directory >= 0 && fstatat(directory, path.constData(), &status, AT_SYMLINK_NOFOLLOW) == 0) {
+                QByteArray renamedPath = QFile::encodeName(entry.renamedPath);
+                makeParentDirectories(directory, renamedPath);
+                if (renameat(directory, path.constData(), directory, renamedPath.constData()) == 0) {
+                    ZSDatabase::getInstance()->setFileChangedSelf(entry.path, 1);
+                }
+                else {
+                    qDebug() << "Error - ZSConnector::applyUpdate() failed to rename" << entry.path << ":" << strerror(errno);
                 }
             }
             break;
         case ZS_FILE_OP_DEL:
-            if (timestamp <= zs_fmetadata_timestamp (fmetadata)) {
-                // remove file from storage. EXCLUDE FROM UPDATE
-                QFile file(zs_fmetadata_path(fmetadata));
-                QDir::setCurrent(ZSSettings::getInstance()->getZeroSyncDirectory());
-                if (file.exists()) {
-                    file.remove();
-                    ZSDatabase::getInstance()->setFileChangedSelf(zs_fmetadata_path(fmetadata), 1);
-                }
+            // remove file from storage. EXCLUDE FROM UPDATE
+            if (directory >= 0 && unlinkat(directory, path.constData(), 0) == 0) {
+                ZSDatabase::getInstance()->setFileChangedSelf(entry.path, 1);
+            }
+            else if (directory >= 0 && errno != ENOENT) {
+                qDebug() << "Error - ZSConnector::applyUpdate() failed to remove" << entry.path << ":" << strerror(errno);
             }
             break;
         }
+    }
+    transferScheduler->dispatch();
+}
 
-        // get next list entry
-        fmetadata = (zs_fmetadata_t *) zlist_next(file_metadata);
+void ZSConnector::applyDirectoryUpdate(int directory, const ZSUpdateEntry &entry)
+{
+    QString path = entry.path.left(entry.path.length() - 1);
+    QByteArray encodedPath = QFile::encodeName(path);
+    struct stat status;
+    if (path.isEmpty() || directory < 0 || fstatat(directory, encodedPath.constData(), &status, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(status.st_mode)) {
+        return;
+    }
+
+    // Newest wins for every file: what is unknown or changed after the operation stays
+    QList<QByteArray> files;
+    bool complete = listTree(directory, encodedPath, files);
+    QHash<QString, qint64> timestamps = ZSDatabase::getInstance()->fetchFileTimestamps(path);
+    QList<QByteArray> covered;
+    foreach (const QByteArray &file, files) {
+        QString filePath = QFile::decodeName(file);
+        if (timestamps.contains(filePath) && (uint64_t) timestamps.value(filePath) <= entry.timestamp) {
+            covered.append(file);
+        }
     }
-    if (zlist_size (requestList) > 0) {
-        zsync_agent_send_request_files(ZSConnector::agent, sender, requestList, requestBytes);
+    QString newPath = entry.renamedPath.endsWith('/') ? entry.renamedPath.left(entry.renamedPath.length() - 1) : entry.renamedPath;
+    QByteArray encodedNewPath = QFile::encodeName(newPath);
+
+    if (!complete || covered.size() != files.size()) {
+        // Only the covered files are moved or removed, the directories of the others remain
+        foreach (const QByteArray &file, covered) {
+            QString filePath = QFile::decodeName(file);
+            if (entry.operation == ZS_FILE_OP_REN) {
+                QByteArray renamedFile = encodedNewPath + file.mid(encodedPath.length());
+                makeParentDirectories(directory, renamedFile);
+                if (renameat(directory, file.constData(), directory, renamedFile.constData()) == 0) {
+                    ZSDatabase::getInstance()->setFileChangedSelf(filePath, 1);
+                }
+                else {
+                    qDebug() << "Error - ZSConnector::applyDirectoryUpdate() failed to rename" << filePath << ":" << strerror(errno);
+                }
+            }
+            else if (entry.operation == ZS_FILE_OP_DEL) {
+                if (unlinkat(directory, file.constData(), 0) == 0) {
+                    ZSDatabase::getInstance()->setFileChangedSelf(filePath, 1);
+                }
+                else if (errno != ENOENT) {
+                    qDebug() << "Error - ZSConnector::applyDirectoryUpdate() failed to remove" << filePath << ":" << strerror(errno);
+                }
+            }
+        }
+        removeEmptyDirectories(directory, encodedPath);
+        qDebug() << "Information - ZSConnector::applyDirectoryUpdate(): Kept" << files.size() - covered.size() << "newer files of" << path;
+        return;
+    }
+
+    // The database goes first, so the watcher finds nothing left to announce when it sees the change
+    if (entry.operation == ZS_FILE_OP_REN) {
+        ZSDatabase::getInstance()->renameDirectoryEntries(path, newPath, false);
+        makeParentDirectories(directory, encodedNewPath);
+        if (renameat(directory, encodedPath.constData(), directory, encodedNewPath.constData()) != 0) {
+            qDebug() << "Error - ZSConnector::applyDirectoryUpdate() failed to rename" << path << ":" << strerror(errno);
+            ZSDatabase::getInstance()->renameDirectoryEntries(newPath, path, false);
+        }
+    }
+    else if (entry.operation == ZS_FILE_OP_DEL) {
+        ZSDatabase::getInstance()->deleteDirectoryEntries(path, false);
+        if (!removeTree(directory, encodedPath)) {
+            // What is left is found by the next scan and announced again
+            qDebug() << "Error - ZSConnector::applyDirectoryUpdate() failed to remove all of" << path;
+        }
+    }
+}
+
+bool ZSConnector::listTree(int directory, QByteArray path, QList<QByteArray> &files)
+{
+    int descriptor = openat(directory, path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (descriptor < 0) {
+        return false;
+    }
+    DIR *entries = fdopendir(descriptor);
+    if (!entries) {
+        close(descriptor);
+        return false;
+    }
+    bool listed = true;
+    struct dirent *entry;
+    while ((entry = readdir(entries))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        bool isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat status;
+            isDirectory = fstatat(descriptor, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode);
+        }
+        // Paths stay relative to the sync directory, like the entries of the database
+        QByteArray entryPath = path + "/" + entry->d_name;
+        if (isDirectory) {
+            listed = listTree(directory, entryPath, files) && listed;
+        }
+        else {
+            files.append(entryPath);
+        }
+    }
+    closedir(entries);
+    return listed;
+}
+
+void ZSConnector::removeEmptyDirectories(int directory, QByteArray path)
+{
+    int descriptor = openat(directory, path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (descriptor < 0) {
+        return;
+    }
+    DIR *entries = fdopendir(descriptor);
+    if (!entries) {
+        close(descriptor);
+        return;
+    }
+    QList<QByteArray> subdirectories;
+    struct dirent *entry;
+    while ((entry = readdir(entries))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        struct stat status;
+        if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && fstatat(descriptor, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode))) {
+            subdirectories.append(path + "/" + entry->d_name);
+        }
+    }
+    closedir(entries);
+    foreach (const QByteArray &subdirectory, subdirectories) {
+        removeEmptyDirectories(directory, subdirectory);
+    }
+    // Fails with ENOTEMPTY where a kept file remains
+    unlinkat(directory, path.constData(), AT_REMOVEDIR);
+}
+
+bool ZSConnector::removeTree(int directory, QByteArray path)
+{
+    int descriptor = openat(directory, path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (descriptor < 0) {
+        return false;
+    }
+    DIR *entries = fdopendir(descriptor);
+    if (!entries) {
+        close(descriptor);
+        return false;
+    }
+    bool removed = true;
+    struct dirent *entry;
+    while ((entry = readdir(entries))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        bool isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat status;
+            isDirectory = fstatat(descriptor, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode);
+        }
+        if (isDirectory) {
+            removed = removeTree(descriptor, QByteArray(entry->d_name)) && removed;
+        }
+        else if (unlinkat(descriptor, entry->d_name, 0) != 0) {
+            removed = false;
+        }
+    }
+    closedir(entries);
+    return unlinkat(directory, path.constData(), AT_REMOVEDIR) == 0 && removed;
+}
+
+int ZSConnector::openSyncDirectory()
+{
+    // Paths are resolved against a descriptor of the sync directory, the working directory of the process is never changed
+    QString path = ZSSettings::getInstance()->getZeroSyncDirectory();
+    if (directoryDescriptor >= 0 && path == directoryPath) {
+        return directoryDescriptor;
+    }
+    if (directoryDescriptor >= 0) {
+        close(directoryDescriptor);
+    }
+    directoryPath = path;
+    directoryDescriptor = open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryDescriptor < 0) {
+        qDebug() << "Error - ZSConnector::openSyncDirectory() failed for" << path << ":" << strerror(errno);
+    }
+    return directoryDescriptor;
+}
+
+void ZSConnector::makeParentDirectories(int directory, QByteArray path)
+{
+    int separator = path.indexOf('/');
+    while (separator > 0) {
+        if (mkdirat(directory, path.left(separator).constData(), 0755) != 0 && errno != EEXIST) {
+            qDebug() << "Error - ZSConnector::makeParentDirectories() failed for" << path << ":" << strerror(errno);
+            return;
+        }
+        separator = path.indexOf('/', separator + 1);
     }
 }
 
 zchunk_t * ZSConnector::get_chunk(char *path, uint64_t chunk_size, uint64_t offset)
 {
-    qDebug() << "get_chunk" << path;
-    char *parent = strdup (ZSSettings::getInstance()->getZeroSyncDirectory().toUtf8().data());
-    zfile_t *file = zfile_new(parent, path);
-    int rc = zfile_input(file);
-    qDebug() << "open file" << rc;
-    zchunk_t *chunk = zfile_read(file, chunk_size, offset);
-    zfile_close(file);
-    zfile_destroy(&file);
-    return zchunk_size (chunk) > 0 ? chunk : NULL;
+    QString filePath = QString::fromUtf8(path);
+    zchunk_t *chunk = NULL;
+    qint64 size;
+    QByteArray packData;
+    if (ZSFilePack::isPackPath(filePath)) {
+        if (!filePack->read(filePath, offset, chunk_size, packData)) {
+            return NULL;
+        }
+        size = packData.size();
+        chunk = zchunk_new(packData.constData(), size);
+    }
+    else {
+        // Reads straight into the chunk handed to the agent, no intermediate buffer
+        chunk = zchunk_new(NULL, chunk_size);
+        size = fileHandleCache->read(filePath, (char *) zchunk_data(chunk), chunk_size, offset);
+        if (size <= 0) {
+            zchunk_destroy(&chunk);
+            return NULL;
+        }
+        zchunk_set_size(chunk, size);
+    }
+
+    if (ZSSettings::getInstance()->getChunkCompression()) {
+        // The agent does not tell who asks, sent chunks are counted under an empty peer name
+        QByteArray frame = chunkCodec->encode(QString(), filePath, (const char *) zchunk_data(chunk), size, offset);
+        zchunk_destroy(&chunk);
+        chunk = zchunk_new(frame.constData(), frame.size());
+    }
+    return chunk;
 }
 
 void ZSConnector::pass_chunk(zchunk_t *chunk, char *path, uint64_t sequence, uint64_t offset)
 {
     qDebug() << "pass_chunk";
-    if (sequence == 0) {
-        if (zfile_exists(ZSSettings::getInstance()->getZeroSyncDirectory().append("/").append(path).toUtf8().data()))
-            zfile_delete(ZSSettings::getInstance()->getZeroSyncDirectory().append("/").append(path).toUtf8().data());
-        ZSDatabase::getInstance()->setFileChanged(path, 1);
-        ZSDatabase::getInstance()->setFileChangedSelf(path, 1);
+    Q_UNUSED(sequence);
+    // The chunk belongs to the agent, the worker gets a copy
+    ZSConnectorJob *job = new ZSConnectorJob();
+    job->type = ZSConnectorJob::Chunk;
+    job->path = QString::fromUtf8(path);
+    job->offset = offset;
+    job->data = QByteArray((const char *) zchunk_data(chunk), zchunk_size(chunk));
+    worker->post(job);
+}
+
+void ZSConnector::applyChunk(QString filePath, qint64 offset, const QByteArray &data)
+{
+    QByteArray content;
+    qint64 contentOffset = offset;
+    bool isPack = ZSFilePack::isPackPath(filePath);
+    bool decoded = true;
+    if (ZSSettings::getInstance()->getChunkCompression()) {
+        decoded = chunkCodec->decode(transferScheduler->getSender(filePath), data.constData(), data.size(), content, contentOffset);
+    }
+    else {
+        content = data;
+    }
+    if (!decoded) {
+        if (isPack) {
+            filePack->abort(filePath);
+        }
+        else {
+            stagingArea->abort(filePath);
+        }
+    }
+    else if (isPack) {
+        // The files of the pack are committed together once all of it arrived
+        filePack->writeChunk(filePath, contentOffset, content.constData(), content.size());
+    }
+    else {
+        // The live file stays untouched until the staging area renames the complete file over it
+        stagingArea->writeChunk(filePath, contentOffset, content.constData(), content.size());
+    }
+    if (isPack ? filePack->isExpected(filePath) : stagingArea->isExpected(filePath)) {
+        transferScheduler->progress(filePath, contentOffset, content.size());
+    }
+    else {
+        transferScheduler->finish(filePath);
     }
-    zfile_t *file = zfile_new(ZSSettings::getInstance()->getZeroSyncDirectory().toUtf8().data(), path);
-    zfile_output(file);
-    zfile_write(file, chunk, offset);
-    zfile_close(file);
-    zfile_destroy(&file);
 }
 
 uint64_t ZSConnector::get_current_state()
@@ -169,27 +481,43 @@ void ZSConnector::slotSynchronizeUpdate(int latest_state)
     QSqlQuery query = ZSDatabase::getInstance()->fetchUpdate(latest_state);
 
     while (query.next()) {
-        zs_fmetadata_t *fmetadata = zs_fmetadata_new();
-        zs_fmetadata_set_path(fmetadata, "%s", query.value(1).toString().toUtf8().data());
-        zs_fmetadata_set_timestamp(fmetadata, query.value(3).toULongLong());
-        if (query.value(2).toString().compare("UPD") == 0) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_UPD);
-            zs_fmetadata_set_size(fmetadata, query.value(4).toULongLong());
-            zs_fmetadata_set_checksum(fmetadata, query.value(6).toULongLong());
-        }
-        else
-        if (query.value(2).toString().compare("REN") == 0) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_REN);
-            zs_fmetadata_set_renamed_path(fmetadata, "%s", query.value(5).toString().toUtf8().data());
-        }
-        else
-        if (query.value(2).toString().compare("DEL") == 0) {
-            zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_DEL);
-        }
-        zlist_append(updateList, fmetadata);
+        zlist_append(updateList, createMetadata(query));
     }
 
     if (zlist_size (updateList) > 0) {
         zsync_agent_send_update(ZSConnector::agent, ZSDatabase::getInstance()->getLatestState(), updateList);
     }
 }
+
+zs_fmetadata_t * ZSConnector::createMetadata(QSqlQuery &query)
+{
+    zs_fmetadata_t *fmetadata = zs_fmetadata_new();
+    QString op = query.value(2).toString();
+    // The protocol has no directory operations, they are sent as REN and DEL of the path with a trailing slash
+    bool isDirectory = op.compare("DIRREN") == 0 || op.compare("DIRDEL") == 0;
+    QString suffix = isDirectory ? QString("/") : QString();
+    zs_fmetadata_set_path(fmetadata, "%s", (query.value(1).toString() + suffix).toUtf8().data());
+    zs_fmetadata_set_timestamp(fmetadata, query.value(3).toULongLong());
+    // The protocol has no append operation, an append is announced as update
+    if (op.compare("UPD") == 0 || op.compare("APP") == 0) {
+        zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_UPD);
+        zs_fmetadata_set_size(fmetadata, query.value(4).toULongLong());
+        zs_fmetadata_set_checksum(fmetadata, ZSStagingArea::checksumPrefix(query.value(6).toString()));
+    }
+    else
+    if (op.compare("REN") == 0 || op.compare("DIRREN") == 0) {
+        zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_REN);
+        zs_fmetadata_set_renamed_path(fmetadata, "%s", (query.value(5).toString() + suffix).toUtf8().data());
+    }
+    else
+    if (op.compare("DEL") == 0 || op.compare("DIRDEL") == 0) {
+        zs_fmetadata_set_operation(fmetadata, ZS_FILE_OP_DEL);
+    }
+    return fmetadata;
+}
+
+void ZSConnector::slotFileChanged(QString path)
+{
+    fileHandleCache->invalidate(path);
+    chunkCodec->forget(path);
+}
@@ -39,12 +39,29 @@
 #include <zyre.h>
 #include <zsync.h>
 #include <zssettings.h>
+#include "zsfilehandlecache.h"
+#include "zsstagingarea.h"
+#include "zstransferscheduler.h"
+#include "zschunkcodec.h"
+#include "zsfilepack.h"
+#include "zsconnectorworker.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <dirent.h>
 
 
 //!  Class that provides the integration of the ZeroSync protocol
 /*!
   This class provides the implemention of the ZeroSync protocol, that is used to
   establish connections to other clients and synchronize files between them.
+
+  The callbacks of the agent run on the thread of the agent. Received updates and
+  chunks are handed to a ZSConnectorWorker and applied on its thread; files are
+  renamed and removed relative to a descriptor of the sync directory, so the
+  working directory of the process is left alone.
 */
 class ZSConnector : public QObject
 {
@@ -53,18 +70,93 @@ class ZSConnector : public QObject
 public:
     explicit ZSConnector(QObject *parent = 0);
 
+    //!  Destructor
+    /*!
+      Stops the agent first, its callbacks use the objects that are destroyed afterwards.
+    */
+    ~ZSConnector();
+
+    //!  Index entries read from the database at once while answering get_update
+    static const int UPDATE_PAGE_SIZE = 1000;
+
 private:
     static zlist_t* get_update(uint64_t from_state);
     static void pass_update(char* sender, zlist_t* file_metadata);
     static zchunk_t* get_chunk(char* path, uint64_t chunk_size, uint64_t offset);
     static void pass_chunk(zchunk_t *chunk, char* path, uint64_t sequence, uint64_t offset);
     static uint64_t get_current_state();
+    static zs_fmetadata_t* createMetadata(QSqlQuery &query);
+
+    //!  Process-Method
+    /*!
+      Applies a job on the thread of the worker.
+    */
+    static void process(ZSConnectorJob &job);
+    static void applyUpdate(QString peer, const QList<ZSUpdateEntry> &entries);
+    static void applyChunk(QString filePath, qint64 offset, const QByteArray &data);
+
+    //!  OpenSyncDirectory-Method
+    /*!
+      Returns the descriptor of the sync directory, reopened if the directory changed.
+      Only used by the worker.
+    */
+    static int openSyncDirectory();
+    static void makeParentDirectories(int directory, QByteArray path);
+
+    //!  ApplyDirectoryUpdate-Method
+    /*!
+      Applies the rename or delete of a directory, the path of the entry ends with a
+      slash. The entries of its files are updated in one transaction. If the directory
+      holds files that are unknown or changed after the operation, only the files the
+      operation covers are moved or removed.
+    */
+    static void applyDirectoryUpdate(int directory, const ZSUpdateEntry &entry);
+
+    //!  ListTree-Method
+    /*!
+      Appends the paths of all files below the directory. Returns false if a directory
+      could not be read.
+    */
+    static bool listTree(int directory, QByteArray path, QList<QByteArray> &files);
+    static void removeEmptyDirectories(int directory, QByteArray path);
+
+    //!  RemoveTree-Method
+    /*!
+      Removes the directory with everything below it. Returns false if something remained.
+    */
+    static bool removeTree(int directory, QByteArray path);
     static zsync_agent_t *agent;
 
+    //!  Files kept open for serving chunks
+    /*!
+      Shared with the static callbacks of the agent like the agent itself.
+    */
+    static ZSFileHandleCache *fileHandleCache;
+
+    //!  Staging files of the transfers in progress
+    static ZSStagingArea *stagingArea;
+
+    //!  Decides which announced files are requested next
+    static ZSTransferScheduler *transferScheduler;
+
+    //!  Frames and compresses chunks if enabled in the settings
+    static ZSChunkCodec *chunkCodec;
+
+    //!  Builds and unpacks the packs small files are transferred in
+    static ZSFilePack *filePack;
+
+    //!  Thread the received updates and chunks are applied on
+    static ZSConnectorWorker *worker;
+    static int directoryDescriptor;
+    static QString directoryPath;
+
+    friend class ZSConnectorWorker;
+
 signals:
 
 public slots:
     void slotSynchronizeUpdate(int);
+    void slotFileChanged(QString);
 
 };
 
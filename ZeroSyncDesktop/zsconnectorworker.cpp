@@ -0,0 +1,125 @@
+/* =========================================================================
+   ZSConnectorWorker - Applies the work handed over by the zsync agent
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsconnectorworker.h"
+#include "zsconnector.h"
+
+ZSConnectorWorker::ZSConnectorWorker(QObject *parent) :
+    QThread(parent),
+    head(&stub),
+    tail(&stub)
+{
+    stub.next.store(0);
+}
+
+
+ZSConnectorWorker::~ZSConnectorWorker()
+{
+    if(isRunning())
+    {
+        ZSConnectorJob *job = new ZSConnectorJob();
+        job->type = ZSConnectorJob::Stop;
+        post(job);
+        wait();
+    }
+    ZSConnectorJob *job;
+    while((job = take()))
+    {
+        delete job;
+    }
+}
+
+
+void ZSConnectorWorker::post(ZSConnectorJob *job)
+{
+    push(job);
+    available.release();
+}
+
+
+void ZSConnectorWorker::push(ZSConnectorJob *job)
+{
+    job->next.store(0);
+    ZSConnectorJob *previous = head.fetchAndStoreOrdered(job);
+    previous->next.storeRelease(job);
+}
+
+
+ZSConnectorJob *ZSConnectorWorker::take()
+{
+    ZSConnectorJob *first = tail;
+    ZSConnectorJob *next = first->next.loadAcquire();
+    if(first == &stub)
+    {
+        if(!next)
+        {
+            return 0;
+        }
+        tail = next;
+        first = next;
+        next = next->next.loadAcquire();
+    }
+    if(next)
+    {
+        tail = next;
+        return first;
+    }
+    // The last job can only be taken with the stub behind it, unless a producer is just linking a job
+    if(first != head.loadAcquire())
+    {
+        return 0;
+    }
+    push(&stub);
+    next = first->next.loadAcquire();
+    if(next)
+    {
+        tail = next;
+        return first;
+    }
+    return 0;
+}
+
+
+void ZSConnectorWorker::run()
+{
+    forever
+    {
+        available.acquire();
+        ZSConnectorJob *job = take();
+        while(!job)
+        {
+            // A producer swapped the head but did not link its job yet
+            QThread::yieldCurrentThread();
+            job = take();
+        }
+        if(job->type == ZSConnectorJob::Stop)
+        {
+            delete job;
+            return;
+        }
+        ZSConnector::process(*job);
+        delete job;
+    }
+}
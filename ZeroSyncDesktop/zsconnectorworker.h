@@ -0,0 +1,114 @@
+/* =========================================================================
+   ZSConnectorWorker - Applies the work handed over by the zsync agent
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSCONNECTORWORKER_H
+#define ZSCONNECTORWORKER_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QAtomicPointer>
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QtDebug>
+
+
+//!  File operation of an update received from a peer
+struct ZSUpdateEntry
+{
+    int operation;
+    QString path;
+    QString renamedPath;
+    qint64 size;
+    quint64 checksum;
+    quint64 timestamp;
+};
+
+
+//!  Work handed from an agent callback to the connector worker
+struct ZSConnectorJob
+{
+    enum Type
+    {
+        Update,
+        Chunk,
+        Stop
+    };
+
+    QAtomicPointer<ZSConnectorJob> next;
+    Type type;
+    QString sender;
+    QList<ZSUpdateEntry> entries;
+    QString path;
+    qint64 offset;
+    QByteArray data;
+};
+
+
+//!  Class that applies the work handed over by the zsync agent
+/*!
+  The callbacks of the agent run on its own thread and must return quickly, so the
+  updates and chunks they receive are copied into jobs and applied here, one after
+  another in the order they arrived. Jobs are posted through a lock-free queue with
+  many producers and this thread as the only consumer, a semaphore counts them so
+  the thread sleeps while the queue is empty.
+*/
+class ZSConnectorWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSConnectorWorker(QObject *parent = 0);
+
+    //!  Destructor
+    /*!
+      Stops the thread after the jobs posted so far were applied.
+    */
+    ~ZSConnectorWorker();
+
+    //!  Post-Method
+    /*!
+      Queues the job, takes ownership of it. May be called from any thread.
+    */
+    void post(ZSConnectorJob *job);
+
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    //!  Producers swap themselves in at the head, the worker takes from the tail
+    QAtomicPointer<ZSConnectorJob> head;
+    ZSConnectorJob *tail;
+    ZSConnectorJob stub;
+    QSemaphore available;
+
+    void push(ZSConnectorJob *job);
+    ZSConnectorJob *take();
+};
+
+#endif // ZSCONNECTORWORKER_H
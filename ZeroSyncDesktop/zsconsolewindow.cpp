@@ -24,12 +24,24 @@
 
 #include "zsconsolewindow.h"
 
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+int ZSConsoleWindow::terminationSockets[2] = { -1, -1 };
+
 ZSConsoleWindow::ZSConsoleWindow(QObject *parent, bool newDirectory) :
-    QObject(parent)
+    QObject(parent),
+    terminationNotifier(0)
 {
+    installTerminationHandler();
+
     if(newDirectory)
     {
         ZSDatabase::getInstance()->deleteAllRowsFromFilesTable();
+        ZSDatabase::getInstance()->resetScanState();
         ZSDatabase::getInstance()->setZeroSyncFolderChangedFlagToFileIndexTable();
     }
 
@@ -41,14 +53,57 @@ ZSConsoleWindow::ZSConsoleWindow(QObject *parent, bool newDirectory) :
 
     timer = new QTimer();
     connect(timer, SIGNAL(timeout()), index, SLOT(slotUpdateIndex()));
+    connect(fileSystemWatcher, SIGNAL(signalFileChangeRecognized(QString)), connector, SLOT(slotFileChanged(QString)));
+    connect(fileSystemWatcher, SIGNAL(signalChangesSettled()), index, SLOT(slotChangesSettled()));
+    connect(index, SIGNAL(signalIndexUpdated(int)), connector, SLOT(slotSynchronizeUpdate(int)));
 
     if(ZSSettings::getInstance()->getSyncInterval() > 0)
     {
         index->slotUpdateIndex();
-        timer->start(ZSSettings::getInstance()->getSyncInterval());
+        timer->start(ZSIndex::getSafetyNetInterval());
     }
 
     QDir directoryOfIndexFile("");
     directoryOfIndexFile.mkpath(QStandardPaths::standardLocations(QStandardPaths::DataLocation).at(0));
 }
 
+
+void ZSConsoleWindow::installTerminationHandler()
+{
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, terminationSockets) != 0)
+    {
+        qDebug() << "Error - ZSConsoleWindow::installTerminationHandler() failed to create the socket pair: " << strerror(errno);
+        return;
+    }
+    terminationNotifier = new QSocketNotifier(terminationSockets[1], QSocketNotifier::Read, this);
+    connect(terminationNotifier, SIGNAL(activated(int)), this, SLOT(slotTerminationRequested()));
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleTermination;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if(sigaction(SIGTERM, &action, 0) != 0 || sigaction(SIGINT, &action, 0) != 0)
+    {
+        qDebug() << "Error - ZSConsoleWindow::installTerminationHandler() failed to install the signal handler: " << strerror(errno);
+    }
+}
+
+
+void ZSConsoleWindow::handleTermination(int)
+{
+    // Only async-signal-safe calls are allowed here, the event loop does the rest
+    char signal = 1;
+    ssize_t written = ::write(terminationSockets[0], &signal, sizeof(signal));
+    Q_UNUSED(written);
+}
+
+
+void ZSConsoleWindow::slotTerminationRequested()
+{
+    terminationNotifier->setEnabled(false);
+    char signal;
+    ssize_t received = ::read(terminationSockets[1], &signal, sizeof(signal));
+    Q_UNUSED(received);
+    QCoreApplication::quit();
+}
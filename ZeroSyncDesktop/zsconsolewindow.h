@@ -27,6 +27,7 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QSocketNotifier>
 #include "zsfilesystemwatcher.h"
 #include "zsdatabase.h"
 #include "zsindex.h"
@@ -95,10 +96,24 @@ private:
     */
     QTimer *timer;
 
+    //!  Termination-Notifier
+    /*!
+      SIGTERM and SIGINT are written to a socket pair by the signal handler, the
+      notifier quits the event loop from there. aboutToQuit is emitted that way, so
+      the watcher records the clean shutdown a warm start depends on.
+    */
+    QSocketNotifier *terminationNotifier;
+    static int terminationSockets[2];
+    static void handleTermination(int);
+    void installTerminationHandler();
+
 signals:
 
 public slots:
 
+private slots:
+    void slotTerminationRequested();
+
 };
 
 #endif // ZSCONSOLEWINDOW_H
@@ -27,18 +27,60 @@
 
 ZSDatabase* ZSDatabase::m_Instance = 0;
 
-ZSDatabase::ZSDatabase()
+ZSDatabase::ZSDatabase() :
+    mutex(QMutex::Recursive),
+    scanGeneration(0),
+    scanGenerationLoaded(false)
 {
     database = QSqlDatabase::addDatabase("QSQLITE");
     database.setDatabaseName(getDataBasePath());    
+    database.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BUSY_TIMEOUT));
     if(!database.open())
     {
         qDebug() << "Error - ZSDatabase::ZSDatabase(QObject *parent) failed: " << database.lastError().text();
     }
+    connections.insert(QThread::currentThread(), database);
+    connectionThread = QThread::currentThread();
+
+    // Readers on other connections do not wait for a writer
+    QSqlQuery query(database);
+    if(!query.exec("PRAGMA journal_mode=WAL"))
+    {
+        qDebug() << "Error - ZSDatabase::ZSDatabase(QObject *parent) failed: " << query.lastError().text();
+    }
     if(!tablesCreated())
     {
         createTables();
     }
+    upgradeTables();
+}
+
+
+bool ZSDatabase::openDatabase()
+{
+    operationCount.ref();
+    // A connection may only be used by the thread that opened it, every thread gets its own;
+    // the caller holds the mutex, so the connection can be switched for the method that follows
+    QThread *thread = QThread::currentThread();
+    if(thread != connectionThread)
+    {
+        if(!connections.contains(thread))
+        {
+            QSqlDatabase connection = QSqlDatabase::addDatabase("QSQLITE", QString("zsdatabase-%1").arg(connections.size()));
+            connection.setDatabaseName(getDataBasePath());
+            connection.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BUSY_TIMEOUT));
+            connections.insert(thread, connection);
+        }
+        database = connections.value(thread);
+        connectionThread = thread;
+    }
+    return database.open();
+}
+
+
+quint64 ZSDatabase::getOperationCount()
+{
+    return operationCount.load();
 }
 
 
@@ -67,7 +109,7 @@ void ZSDatabase::createTables()
         qDebug() << "Error - ZSDatabase::createTables() failed: Can't open resource file :sql/create_index.sql";
     }
 
-    if(database.open())
+    if(openDatabase())
     {
         QString databaseQuery;
         QSqlQuery query(database);
@@ -84,7 +126,7 @@ void ZSDatabase::createTables()
         qDebug() << "Error - ZSDatabase::createTables() failed: " << database.lastError().text();
     }
 
-    if(database.open())
+    if(openDatabase())
     {
         QString databaseQuery;
         QSqlQuery query(database);
@@ -103,6 +145,67 @@ void ZSDatabase::createTables()
 }
 
 
+void ZSDatabase::upgradeTables()
+{
+    if(!openDatabase())
+    {
+        qDebug() << "Error - ZSDatabase::upgradeTables() failed: " << database.lastError().text();
+        return;
+    }
+
+    // Databases of older versions lack the newer columns, they are appended in the
+    // order of create_files.sql so the column indices stay the same
+    QSqlQuery query(database);
+    QStringList columns;
+    if(query.exec("PRAGMA table_info(files)"))
+    {
+        while(query.next())
+        {
+            columns.append(query.value(1).toString());
+        }
+    }
+    if(!columns.contains("generation") && !query.exec("ALTER TABLE files ADD COLUMN generation INTEGER NOT NULL DEFAULT 0"))
+    {
+        qDebug() << "Error - ZSDatabase::upgradeTables() failed to add generation column: " << query.lastError().text();
+    }
+    if(!columns.contains("appended") && !query.exec("ALTER TABLE files ADD COLUMN appended INTEGER NOT NULL DEFAULT 0"))
+    {
+        qDebug() << "Error - ZSDatabase::upgradeTables() failed to add appended column: " << query.lastError().text();
+    }
+
+    // Tables used for the warm start are created if they are missing
+    executeSqlResource(":/sql/resources/sql/create_directories.sql");
+    executeSqlResource(":/sql/resources/sql/create_scanstate.sql");
+    executeSqlResource(":/sql/resources/sql/create_chunks.sql");
+    executeSqlResource(":/sql/resources/sql/create_chunks_index.sql");
+    executeSqlResource(":/sql/resources/sql/create_hashstate.sql");
+    executeSqlResource(":/sql/resources/sql/create_files_checksum_index.sql");
+    executeSqlResource(":/sql/resources/sql/create_transfers.sql");
+    executeSqlResource(":/sql/resources/sql/create_fileindex_path_index.sql");
+    executeSqlResource(":/sql/resources/sql/create_directorychanges.sql");
+}
+
+
+void ZSDatabase::executeSqlResource(QString resource)
+{
+    QFile file(resource);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Error - ZSDatabase::executeSqlResource() failed: Can't open resource file " << resource;
+        return;
+    }
+
+    QTextStream inputStream(&file);
+    QString databaseQuery = inputStream.readAll();
+    file.close();
+    QSqlQuery query(database);
+    if(!query.exec(databaseQuery))
+    {
+        qDebug() << "Error - ZSDatabase::executeSqlResource() failed to execute query from " << resource << ": " << query.lastError().text();
+    }
+}
+
+
 bool ZSDatabase::tablesCreated()
 {
     QFile databaseFile(getDataBasePath());
@@ -117,7 +220,7 @@ bool ZSDatabase::tablesCreated()
 void ZSDatabase::deleteAllRowsFromFilesTable()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("DELETE FROM files");
@@ -137,7 +240,7 @@ void ZSDatabase::setZeroSyncFolderChangedFlagToFileIndexTable()
 {
     mutex.lock();
     int state = getLatestState() + 1;
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("INSERT INTO fileindex (state, path, operation, timestamp, size, newpath, checksum) VALUES (:state, :path, :operation, :timestamp, :size, :newpath, :checksum)");
@@ -161,13 +264,13 @@ void ZSDatabase::setZeroSyncFolderChangedFlagToFileIndexTable()
 }
 
 
-void ZSDatabase::insertNewFile(QString path, qint64 timestamp, QString checksum, qint64 size)
+void ZSDatabase::insertNewFile(QString path, qint64 timestamp, QString checksum, qint64 size, int generation, int changed_self)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
-        query.prepare("INSERT INTO files (path, timestamp, checksum, size, newpath, changed, updated, renamed, deleted, changed_self, reference) VALUES (:path, :timestamp, :checksum, :size, :newpath, :changed, :updated, :renamed, :deleted, :changed_self, :reference)");
+        query.prepare("INSERT INTO files (path, timestamp, checksum, size, newpath, changed, updated, renamed, deleted, changed_self, reference, generation) VALUES (:path, :timestamp, :checksum, :size, :newpath, :changed, :updated, :renamed, :deleted, :changed_self, :reference, :generation)");
         query.bindValue(":path", path);
         query.bindValue(":timestamp", timestamp);
         query.bindValue(":checksum", checksum);
@@ -177,8 +280,9 @@ void ZSDatabase::insertNewFile(QString path, qint64 timestamp, QString checksum,
         query.bindValue(":updated", 1);
         query.bindValue(":renamed", 0);
         query.bindValue(":deleted", 0);
-        query.bindValue(":changed_self", 0);
+        query.bindValue(":changed_self", changed_self);
         query.bindValue(":reference", 0);
+        query.bindValue(":generation", qMax(generation, scanGeneration));
         if(!query.exec())
         {
             qDebug() << "Error - ZSDatabase::insertNewFile() failed to execute query: " << query.lastError().text();
@@ -195,7 +299,7 @@ void ZSDatabase::insertNewFile(QString path, qint64 timestamp, QString checksum,
 void ZSDatabase::setFileChanged(QString path, int value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET changed = :value WHERE path = :path");
@@ -217,7 +321,7 @@ void ZSDatabase::setFileChanged(QString path, int value)
 void ZSDatabase::setFileUpdated(QString path, int value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET updated = :value WHERE path = :path");
@@ -239,7 +343,7 @@ void ZSDatabase::setFileUpdated(QString path, int value)
 void ZSDatabase::setFileRenamed(QString path, int value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET renamed = :value WHERE path = :path");
@@ -260,7 +364,7 @@ void ZSDatabase::setFileRenamed(QString path, int value)
 void ZSDatabase::setFileReference(QString path, quint32 value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET reference = :value WHERE path = :path");
@@ -281,7 +385,7 @@ void ZSDatabase::setFileReference(QString path, quint32 value)
 void ZSDatabase::setFileDeleted(QString path, int value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET deleted = :value WHERE path = :path");
@@ -302,7 +406,7 @@ void ZSDatabase::setFileDeleted(QString path, int value)
 void ZSDatabase::setFileTimestamp(QString path, qint64 value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET timestamp = :value WHERE path = :path");
@@ -323,7 +427,7 @@ void ZSDatabase::setFileTimestamp(QString path, qint64 value)
 void ZSDatabase::setFileHashToZero(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET checksum = 0 WHERE path = :path");
@@ -344,7 +448,7 @@ void ZSDatabase::setFileHashToZero(QString path)
 void ZSDatabase::setFileChangedSelf(QString path, int value)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET changed_self = :value WHERE path = :path");
@@ -365,7 +469,7 @@ void ZSDatabase::setFileChangedSelf(QString path, int value)
 void ZSDatabase::setNewPath(QString path, QString newPath)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET newpath = :newPath WHERE path = :path");
@@ -383,10 +487,77 @@ void ZSDatabase::setNewPath(QString path, QString newPath)
     mutex.unlock();
 }
 
+void ZSDatabase::renameFileEntry(QString path, QString newPath)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Joins a running scan transaction instead of committing it halfway
+        bool ownTransaction = database.transaction();
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO files (path, timestamp, checksum, size, newpath, changed, updated, renamed, reference, deleted, changed_self, generation) SELECT :newPath, timestamp, checksum, size, NULL, 0, 0, 0, 0, 0, 0, MAX(generation, :generation) FROM files WHERE path = :path");
+        query.bindValue(":newPath", newPath);
+        query.bindValue(":generation", scanGeneration);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::renameFileEntry() failed to execute query: " << query.lastError().text();
+            if(ownTransaction)
+            {
+                database.rollback();
+            }
+            mutex.unlock();
+            return;
+        }
+        query.prepare("UPDATE files SET changed = 1, updated = 0, renamed = 1, deleted = 0, changed_self = 0, checksum = 0, newpath = :newPath WHERE path = :path");
+        query.bindValue(":newPath", newPath);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::renameFileEntry() failed to execute query: " << query.lastError().text();
+            if(ownTransaction)
+            {
+                database.rollback();
+            }
+            mutex.unlock();
+            return;
+        }
+        // The content did not change, so chunks and hash state move along with the file
+        foreach(QString table, QStringList() << "chunks" << "hashstate")
+        {
+            query.prepare(QString("DELETE FROM %1 WHERE path = :newPath").arg(table));
+            query.bindValue(":newPath", newPath);
+            query.exec();
+            query.prepare(QString("UPDATE %1 SET path = :newPath WHERE path = :path").arg(table));
+            query.bindValue(":newPath", newPath);
+            query.bindValue(":path", path);
+            if(!query.exec())
+            {
+                qDebug() << "Error - ZSDatabase::renameFileEntry() failed to execute query: " << query.lastError().text();
+                if(ownTransaction)
+                {
+                    database.rollback();
+                }
+                mutex.unlock();
+                return;
+            }
+        }
+        if(ownTransaction)
+        {
+            database.commit();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::renameFileEntry() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
 bool ZSDatabase::isFileChanged(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path AND changed = 1");
@@ -416,7 +587,7 @@ bool ZSDatabase::isFileChanged(QString path)
 bool ZSDatabase::isFileChangedSelf(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path AND changed_self = 1");
@@ -446,7 +617,7 @@ bool ZSDatabase::isFileChangedSelf(QString path)
 bool ZSDatabase::isFileUpdated(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path AND updated = 1");
@@ -476,7 +647,7 @@ bool ZSDatabase::isFileUpdated(QString path)
 bool ZSDatabase::isFileRenamed(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path AND renamed = 1");
@@ -506,7 +677,7 @@ bool ZSDatabase::isFileRenamed(QString path)
 bool ZSDatabase::isFileDeleted(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path AND deleted = 1");
@@ -536,7 +707,7 @@ bool ZSDatabase::isFileDeleted(QString path)
 QString ZSDatabase::getFilePathForHash(QString hash)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE checksum = :checksum");
@@ -567,7 +738,7 @@ QString ZSDatabase::getFilePathForHash(QString hash)
 void ZSDatabase::setFileMetaData(QString path, qint64 timestamp, QString checksum, qint64 size)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("UPDATE files SET timestamp = :timestamp, checksum = :checksum,  size = :size WHERE path = :path");
@@ -590,8 +761,8 @@ void ZSDatabase::setFileMetaData(QString path, qint64 timestamp, QString checksu
 
 bool ZSDatabase::existsFileEntry(QString path)
 {
-    mutex.unlock();
-    if(database.open())
+    mutex.lock();
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path");
@@ -621,7 +792,7 @@ bool ZSDatabase::existsFileEntry(QString path)
 bool ZSDatabase::existsFileHash(QString checksum)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE checksum = :checksum");
@@ -652,7 +823,7 @@ bool ZSDatabase::existsFileHash(QString checksum)
 QSqlQuery ZSDatabase::fetchAllChangedEntriesInFilesTable()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE changed = 1");
@@ -679,7 +850,7 @@ QSqlQuery ZSDatabase::fetchAllChangedEntriesInFilesTable()
 QSqlQuery ZSDatabase::fetchUpdate(int lastest_state)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM fileindex WHERE state = :state AND changed_self = 0");
@@ -707,7 +878,7 @@ QSqlQuery ZSDatabase::fetchUpdate(int lastest_state)
 QSqlQuery ZSDatabase::fetchUpdateFromState(int fromState)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM fileindex WHERE state > :from");
@@ -732,10 +903,55 @@ QSqlQuery ZSDatabase::fetchUpdateFromState(int fromState)
     return QSqlQuery();
 }
 
+QSqlQuery ZSDatabase::fetchNetUpdatePage(int fromState, int toState, int afterState, qint64 afterRow, int limit)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.setForwardOnly(true);
+        query.prepare("SELECT entry.state, entry.path, entry.operation, entry.timestamp, entry.size, entry.newpath, entry.checksum, entry.rowid "
+                      "FROM fileindex entry "
+                      "WHERE entry.state > :from AND entry.state <= :to1 "
+                      "AND (entry.state > :afterState1 OR (entry.state = :afterState2 AND entry.rowid > :afterRow)) "
+                      "AND NOT (entry.operation IN ('UPD', 'APP', 'DEL') AND EXISTS ("
+                      "    SELECT 1 FROM fileindex later "
+                      "    WHERE later.path = entry.path AND later.operation IN ('UPD', 'APP', 'DEL') AND later.state <= :to2 "
+                      "    AND (later.state > entry.state OR (later.state = entry.state AND later.rowid > entry.rowid)) "
+                      "    AND NOT EXISTS ("
+                      "        SELECT 1 FROM fileindex rename "
+                      "        WHERE ((rename.path = entry.path AND rename.operation = 'REN') "
+                      "            OR (rename.operation IN ('DIRREN', 'DIRDEL') AND substr(entry.path, 1, length(rename.path) + 1) = rename.path || '/')) "
+                      "        AND (rename.state > entry.state OR (rename.state = entry.state AND rename.rowid > entry.rowid)) "
+                      "        AND (rename.state < later.state OR (rename.state = later.state AND rename.rowid < later.rowid))))) "
+                      "ORDER BY entry.state, entry.rowid "
+                      "LIMIT :limit");
+        query.bindValue(":from", fromState);
+        query.bindValue(":to1", toState);
+        query.bindValue(":to2", toState);
+        query.bindValue(":afterState1", afterState);
+        query.bindValue(":afterState2", afterState);
+        query.bindValue(":afterRow", afterRow);
+        query.bindValue(":limit", limit);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::fetchNetUpdatePage() failed to execute query: " << query.lastError().text();
+        }
+        mutex.unlock();
+        return query;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchNetUpdatePage() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return QSqlQuery();
+}
+
 QSqlQuery ZSDatabase::fetchAllEntriesInFilesTable()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files");
@@ -762,7 +978,7 @@ QSqlQuery ZSDatabase::fetchAllEntriesInFilesTable()
 QSqlQuery ZSDatabase::fetchFileByPath(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT * FROM files WHERE path = :path");
@@ -792,7 +1008,7 @@ QSqlQuery ZSDatabase::fetchFileByPath(QString path)
 void ZSDatabase::insertNewIndexEntry(int state, QString path, QString operation, qint64 timestamp, qint64 size, QString newpath, QString checksum, int changed_self)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("INSERT INTO fileindex (state, path, operation, timestamp, size, newpath, checksum, changed_self) VALUES (:state, :path, :operation, :timestamp, :size, :newpath, :checksum, :changed_self)");
@@ -819,7 +1035,7 @@ void ZSDatabase::insertNewIndexEntry(int state, QString path, QString operation,
 int ZSDatabase::getLatestState()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT MAX(state) FROM fileindex");
@@ -848,7 +1064,7 @@ int ZSDatabase::getLatestState()
 qint64 ZSDatabase::getTimestampForFile(QString path)
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
         query.prepare("SELECT timestamp FROM files WHERE path = :path");
@@ -875,39 +1091,977 @@ qint64 ZSDatabase::getTimestampForFile(QString path)
     return -1;
 }
 
-QSqlQuery ZSDatabase::fetchAllUndeletedEntries()
+int ZSDatabase::getLatestScanGeneration()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
-        query.prepare("SELECT * FROM files WHERE deleted = 0");
+        // Directories are stamped as well, a new scan has to be newer than both
+        query.prepare("SELECT MAX(generation) FROM (SELECT generation FROM files UNION ALL SELECT generation FROM directories)");
         if(!query.exec())
         {
-            qDebug() << "Error: Can't execute database query to fetch all undeleted files";
+            qDebug() << "Error - ZSDatabase::getLatestScanGeneration() failed to execute query: " << query.lastError().text();
             mutex.unlock();
-            return QSqlQuery();
+            return 0;
         }
-        else
+        if(query.next())
         {
             mutex.unlock();
-            return query;
+            return query.value(0).toInt();
         }
-    }else {
-        qDebug() << "Error: fetAllundeletedEntries() failed: " << database.lastError().text();
+        mutex.unlock();
+        return 0;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::getLatestScanGeneration() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return 0;
+}
+
+int ZSDatabase::nextScanGeneration()
+{
+    mutex.lock();
+    // Only this process writes generations, the stored maximum is needed once
+    if(!scanGenerationLoaded)
+    {
+        scanGeneration = getLatestScanGeneration();
+        scanGenerationLoaded = true;
+    }
+    int generation = ++scanGeneration;
+    mutex.unlock();
+    return generation;
+}
+
+int ZSDatabase::getScanGeneration()
+{
+    mutex.lock();
+    int generation = scanGeneration;
+    mutex.unlock();
+    return generation;
+}
+
+bool ZSDatabase::markFileVisited(QString path, int generation)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("UPDATE files SET generation = :generation WHERE path = :path");
+        query.bindValue(":generation", generation);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::markFileVisited() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return false;
+        }
+        // No affected row means there is no entry for the path yet
+        bool exists = query.numRowsAffected() > 0;
+        mutex.unlock();
+        return exists;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::markFileVisited() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return false;
+}
+
+int ZSDatabase::markUnvisitedFilesDeleted(int generation, QString directory, bool recursive)
+{
+    QString prefix = directory.isEmpty() ? QString("") : directory + "/";
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        QString statement = "UPDATE files SET changed = 1, updated = 0, deleted = 1, timestamp = :timestamp "
+                            "WHERE generation < :generation AND renamed = 0 AND deleted = 0 AND changed_self = 0 "
+                            "AND substr(path, 1, length(:prefix1)) = :prefix2";
+        if(!recursive)
+        {
+            statement.append(" AND instr(substr(path, length(:prefix3) + 1), '/') = 0");
+        }
+        query.prepare(statement);
+        query.bindValue(":timestamp", QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+        query.bindValue(":generation", generation);
+        query.bindValue(":prefix1", prefix);
+        query.bindValue(":prefix2", prefix);
+        if(!recursive)
+        {
+            query.bindValue(":prefix3", prefix);
+        }
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::markUnvisitedFilesDeleted() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return 0;
+        }
+        int deletedFiles = query.numRowsAffected();
+        mutex.unlock();
+        return deletedFiles;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::markUnvisitedFilesDeleted() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return 0;
+}
+
+void ZSDatabase::beginTransaction()
+{
+    // Held until commitTransaction(), the methods called in between lock it recursively
+    mutex.lock();
+    if(!openDatabase() || !database.transaction())
+    {
+        qDebug() << "Error - ZSDatabase::beginTransaction() failed: " << database.lastError().text();
+    }
+    transactionTimer.start();
+}
+
+void ZSDatabase::commitTransaction()
+{
+    if(!openDatabase() || !database.commit())
+    {
+        qDebug() << "Error - ZSDatabase::commitTransaction() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::yieldTransaction()
+{
+    if(transactionTimer.elapsed() < MAXIMUM_TRANSACTION_TIME)
+    {
+        return;
+    }
+    commitTransaction();
+    // QMutex is not fair, without a pause the next lock would be taken again before a waiting thread runs
+    QThread::msleep(1);
+    beginTransaction();
+}
+
+QSqlQuery ZSDatabase::fetchAllDirectories()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT path, mtime, scanned FROM directories");
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::fetchAllDirectories() failed to execute query: " << query.lastError().text();
+        }
+        mutex.unlock();
+        return query;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchAllDirectories() failed: " << database.lastError().text();
     }
     mutex.unlock();
     return QSqlQuery();
 }
 
+void ZSDatabase::setDirectoryScanned(QString path, qint64 lastModified, int generation)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO directories (path, mtime, scanned, generation) "
+                      "VALUES (:path, :mtime, :scanned, :generation)");
+        query.bindValue(":path", path);
+        query.bindValue(":mtime", lastModified);
+        query.bindValue(":scanned", QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+        query.bindValue(":generation", generation);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setDirectoryScanned() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setDirectoryScanned() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::markDirectoryVisited(QString path, int generation)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("UPDATE directories SET generation = :generation WHERE path = :path");
+        query.bindValue(":generation", generation);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::markDirectoryVisited() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::markDirectoryVisited() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::markDirectoryUnread(QString path, int generation)
+{
+    QString prefix = path.isEmpty() ? QString("") : path + "/";
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("UPDATE files SET generation = MAX(generation, :generation) WHERE substr(path, 1, length(:prefix1)) = :prefix2");
+        query.bindValue(":generation", generation);
+        query.bindValue(":prefix1", prefix);
+        query.bindValue(":prefix2", prefix);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::markDirectoryUnread() failed to execute query: " << query.lastError().text();
+        }
+        query.prepare("UPDATE directories SET generation = MAX(generation, :generation), mtime = 0 WHERE substr(path, 1, length(:prefix1)) = :prefix2 OR path = :path");
+        query.bindValue(":generation", generation);
+        query.bindValue(":prefix1", prefix);
+        query.bindValue(":prefix2", prefix);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::markDirectoryUnread() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::markDirectoryUnread() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+QStringList ZSDatabase::removeUnvisitedDirectories(int generation)
+{
+    QStringList removedDirectories;
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT path FROM directories WHERE generation < :generation");
+        query.bindValue(":generation", generation);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::removeUnvisitedDirectories() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return removedDirectories;
+        }
+        while(query.next())
+        {
+            removedDirectories.append(query.value(0).toString());
+        }
+
+        query.prepare("DELETE FROM directories WHERE generation < :generation");
+        query.bindValue(":generation", generation);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::removeUnvisitedDirectories() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::removeUnvisitedDirectories() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return removedDirectories;
+}
+
+bool ZSDatabase::isCleanShutdown()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT value FROM scanstate WHERE key = 'clean_shutdown'");
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::isCleanShutdown() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return false;
+        }
+        if(query.next())
+        {
+            bool cleanShutdown = query.value(0).toInt() == 1;
+            mutex.unlock();
+            return cleanShutdown;
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::isCleanShutdown() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return false;
+}
+
+void ZSDatabase::setCleanShutdown(bool cleanShutdown)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO scanstate (key, value) VALUES ('clean_shutdown', :value)");
+        query.bindValue(":value", cleanShutdown ? 1 : 0);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setCleanShutdown() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setCleanShutdown() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+qint64 ZSDatabase::getLastFullScanTime()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT value FROM scanstate WHERE key = 'last_full_scan'");
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::getLastFullScanTime() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return 0;
+        }
+        if(query.next())
+        {
+            qint64 lastFullScanTime = query.value(0).toLongLong();
+            mutex.unlock();
+            return lastFullScanTime;
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::getLastFullScanTime() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return 0;
+}
+
+void ZSDatabase::setLastFullScanTime(qint64 lastFullScanTime)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO scanstate (key, value) VALUES ('last_full_scan', :value)");
+        query.bindValue(":value", lastFullScanTime);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setLastFullScanTime() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setLastFullScanTime() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::resetScanState()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        if(!query.exec("DELETE FROM directories"))
+        {
+            qDebug() << "Error - ZSDatabase::resetScanState() failed to execute query: " << query.lastError().text();
+        }
+        if(!query.exec("DELETE FROM scanstate WHERE key IN ('clean_shutdown', 'last_full_scan')"))
+        {
+            qDebug() << "Error - ZSDatabase::resetScanState() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::resetScanState() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::setFileChunks(QString path, const QList<ZSChunk> &chunks)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Joins a running scan transaction instead of committing it halfway
+        bool ownTransaction = database.transaction();
+        QSqlQuery query(database);
+        query.prepare("DELETE FROM chunks WHERE path = :path");
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setFileChunks() failed to execute query: " << query.lastError().text();
+        }
+        query.prepare("INSERT INTO chunks (path, offset, length, checksum) VALUES (:path, :offset, :length, :checksum)");
+        foreach(const ZSChunk &chunk, chunks)
+        {
+            query.bindValue(":path", path);
+            query.bindValue(":offset", chunk.offset);
+            query.bindValue(":length", chunk.length);
+            query.bindValue(":checksum", chunk.hash);
+            if(!query.exec())
+            {
+                qDebug() << "Error - ZSDatabase::setFileChunks() failed to execute query: " << query.lastError().text();
+                break;
+            }
+        }
+        if(ownTransaction)
+        {
+            database.commit();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setFileChunks() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+QList<ZSChunk> ZSDatabase::getFileChunks(QString path)
+{
+    QList<ZSChunk> chunks;
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT offset, length, checksum FROM chunks WHERE path = :path ORDER BY offset");
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::getFileChunks() failed to execute query: " << query.lastError().text();
+        }
+        while(query.next())
+        {
+            ZSChunk chunk;
+            chunk.offset = query.value(0).toLongLong();
+            chunk.length = query.value(1).toLongLong();
+            chunk.hash = query.value(2).toString();
+            chunks.append(chunk);
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::getFileChunks() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return chunks;
+}
+
+QSqlQuery ZSDatabase::fetchChunksWithHash(QString checksum)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT path, offset, length FROM chunks WHERE checksum = :checksum");
+        query.bindValue(":checksum", checksum);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::fetchChunksWithHash() failed to execute query: " << query.lastError().text();
+        }
+        mutex.unlock();
+        return query;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchChunksWithHash() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return QSqlQuery();
+}
+
+void ZSDatabase::removeStaleContentData()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        if(!query.exec("DELETE FROM chunks WHERE path NOT IN (SELECT path FROM files WHERE deleted = 0 AND renamed = 0)"))
+        {
+            qDebug() << "Error - ZSDatabase::removeStaleContentData() failed to execute query: " << query.lastError().text();
+        }
+        if(!query.exec("DELETE FROM hashstate WHERE path NOT IN (SELECT path FROM files WHERE deleted = 0 AND renamed = 0)"))
+        {
+            qDebug() << "Error - ZSDatabase::removeStaleContentData() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::removeStaleContentData() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::setFileHashState(QString path, qint64 size, QString fingerprint, QByteArray state)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO hashstate (path, size, fingerprint, state) VALUES (:path, :size, :fingerprint, :state)");
+        query.bindValue(":path", path);
+        query.bindValue(":size", size);
+        query.bindValue(":fingerprint", fingerprint);
+        query.bindValue(":state", state);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setFileHashState() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setFileHashState() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+void ZSDatabase::removeFileHashState(QString path)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("DELETE FROM hashstate WHERE path = :path");
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::removeFileHashState() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::removeFileHashState() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+bool ZSDatabase::getFileHashState(QString path, qint64 &size, QString &fingerprint, QByteArray &state)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT size, fingerprint, state FROM hashstate WHERE path = :path");
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::getFileHashState() failed to execute query: " << query.lastError().text();
+            mutex.unlock();
+            return false;
+        }
+        if(query.next())
+        {
+            size = query.value(0).toLongLong();
+            fingerprint = query.value(1).toString();
+            state = query.value(2).toByteArray();
+            mutex.unlock();
+            return true;
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::getFileHashState() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return false;
+}
+
+void ZSDatabase::setFileAppended(QString path, bool appended)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Only if every change since the last index update was an append, the whole change is one
+        QSqlQuery query(database);
+        query.prepare("UPDATE files SET appended = CASE WHEN changed = 1 THEN appended AND :appended1 ELSE :appended2 END WHERE path = :path");
+        query.bindValue(":appended1", appended ? 1 : 0);
+        query.bindValue(":appended2", appended ? 1 : 0);
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setFileAppended() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setFileAppended() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+QSqlQuery ZSDatabase::fetchAllUndeletedEntries()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT * FROM files WHERE deleted = 0");
+        if(!query.exec())
+        {
+            qDebug() << "Error: Can't execute database query to fetch all undeleted files";
+            mutex.unlock();
+            return QSqlQuery();
+        }
+        else
+        {
+            mutex.unlock();
+            return query;
+        }
+    }else {
+        qDebug() << "Error: fetAllundeletedEntries() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return QSqlQuery();
+}
+
+
+QString ZSDatabase::getFilePathForChecksumPrefix(QString prefix, qint64 size)
+{
+    QString path;
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Hex digits sort below 'g', so the prefix becomes a range on the checksum index
+        QSqlQuery query(database);
+        query.prepare("SELECT path FROM files WHERE checksum >= :from AND checksum < :to AND size = :size AND deleted = 0 AND renamed = 0 LIMIT 1");
+        query.bindValue(":from", prefix);
+        query.bindValue(":to", prefix + "g");
+        query.bindValue(":size", size);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::getFilePathForChecksumPrefix() failed to execute query: " << query.lastError().text();
+        }
+        else
+        if(query.next())
+        {
+            path = query.value(0).toString();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::getFilePathForChecksumPrefix() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return path;
+}
+
+
+void ZSDatabase::setTransfer(QString path, qint64 size, QString checksum, QByteArray ranges)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO transfers (path, size, checksum, ranges, updated) VALUES (:path, :size, :checksum, :ranges, :updated)");
+        query.bindValue(":path", path);
+        query.bindValue(":size", size);
+        query.bindValue(":checksum", checksum);
+        query.bindValue(":ranges", ranges);
+        query.bindValue(":updated", QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::setTransfer() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::setTransfer() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+
+void ZSDatabase::removeTransfer(QString path)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("DELETE FROM transfers WHERE path = :path");
+        query.bindValue(":path", path);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::removeTransfer() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::removeTransfer() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
+
+
+QSqlQuery ZSDatabase::fetchAllTransfers()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        if(!query.exec("SELECT path, size, checksum, ranges, updated FROM transfers"))
+        {
+            qDebug() << "Error - ZSDatabase::fetchAllTransfers() failed to execute query: " << query.lastError().text();
+        }
+        mutex.unlock();
+        return query;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchAllTransfers() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return QSqlQuery();
+}
+
+int ZSDatabase::renameDirectoryEntries(QString path, QString newPath, bool announce)
+{
+    QString prefix = path + "/";
+    QString newPrefix = newPath + "/";
+    int renamedFiles = 0;
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Joins a running scan transaction instead of committing it halfway
+        bool ownTransaction = database.transaction();
+        QSqlQuery query(database);
+        bool succeeded = true;
+        foreach(QString table, QStringList() << "files" << "chunks" << "hashstate" << "directories")
+        {
+            // Entries of deleted files stay behind, they describe the old location
+            // Moved entries count as visited by a running scan, their new place may be scanned already
+            bool stamped = table == "files" || table == "directories";
+            QString statement = QString("UPDATE OR REPLACE %1 SET path = :newPrefix || substr(path, length(:prefix1) + 1)%2 "
+                                        "WHERE substr(path, 1, length(:prefix2)) = :prefix3").arg(table).arg(stamped ? ", generation = MAX(generation, :generation)" : "");
+            if(table == "files")
+            {
+                statement.append(" AND deleted = 0");
+            }
+            query.prepare(statement);
+            if(stamped)
+            {
+                query.bindValue(":generation", scanGeneration);
+            }
+            query.bindValue(":newPrefix", newPrefix);
+            query.bindValue(":prefix1", prefix);
+            query.bindValue(":prefix2", prefix);
+            query.bindValue(":prefix3", prefix);
+            if(!query.exec())
+            {
+                succeeded = false;
+                break;
+            }
+            if(table == "files")
+            {
+                renamedFiles = query.numRowsAffected();
+            }
+        }
+        if(succeeded)
+        {
+            query.prepare("UPDATE OR REPLACE directories SET path = :newPath, generation = MAX(generation, :generation) WHERE path = :path");
+            query.bindValue(":newPath", newPath);
+            query.bindValue(":generation", scanGeneration);
+            query.bindValue(":path", path);
+            succeeded = query.exec();
+        }
+        if(succeeded && announce && renamedFiles > 0)
+        {
+            query.prepare("INSERT INTO directorychanges (path, newpath, operation, timestamp) VALUES (:path, :newPath, 'DIRREN', :timestamp)");
+            query.bindValue(":path", path);
+            query.bindValue(":newPath", newPath);
+            query.bindValue(":timestamp", QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+            succeeded = query.exec();
+        }
+        if(!succeeded)
+        {
+            qDebug() << "Error - ZSDatabase::renameDirectoryEntries() failed to execute query: " << query.lastError().text();
+            renamedFiles = 0;
+        }
+        if(ownTransaction)
+        {
+            if(succeeded)
+            {
+                database.commit();
+            }
+            else
+            {
+                database.rollback();
+            }
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::renameDirectoryEntries() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return renamedFiles;
+}
+
+int ZSDatabase::deleteDirectoryEntries(QString path, bool announce)
+{
+    QString prefix = path + "/";
+    int removedFiles = 0;
+    mutex.lock();
+    if(openDatabase())
+    {
+        // Joins a running scan transaction instead of committing it halfway
+        bool ownTransaction = database.transaction();
+        QSqlQuery query(database);
+        bool succeeded = true;
+        int pendingFiles = 0;
+        query.prepare("SELECT COUNT(*) FROM files WHERE substr(path, 1, length(:prefix1)) = :prefix2 AND (deleted = 0 OR changed = 1)");
+        query.bindValue(":prefix1", prefix);
+        query.bindValue(":prefix2", prefix);
+        if(query.exec() && query.next())
+        {
+            pendingFiles = query.value(0).toInt();
+        }
+        foreach(QString table, QStringList() << "files" << "chunks" << "hashstate" << "directories")
+        {
+            query.prepare(QString("DELETE FROM %1 WHERE substr(path, 1, length(:prefix1)) = :prefix2 OR path = :path").arg(table));
+            query.bindValue(":prefix1", prefix);
+            query.bindValue(":prefix2", prefix);
+            query.bindValue(":path", path);
+            if(!query.exec())
+            {
+                qDebug() << "Error - ZSDatabase::deleteDirectoryEntries() failed to execute query: " << query.lastError().text();
+                succeeded = false;
+                break;
+            }
+            if(table == "files")
+            {
+                removedFiles = query.numRowsAffected();
+            }
+        }
+        // Files whose deletes were announced one by one already need no directory delete
+        if(succeeded && announce && pendingFiles > 0)
+        {
+            query.prepare("INSERT INTO directorychanges (path, newpath, operation, timestamp) VALUES (:path, NULL, 'DIRDEL', :timestamp)");
+            query.bindValue(":path", path);
+            query.bindValue(":timestamp", QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+            if(!query.exec())
+            {
+                qDebug() << "Error - ZSDatabase::deleteDirectoryEntries() failed to execute query: " << query.lastError().text();
+                succeeded = false;
+            }
+        }
+        if(!succeeded)
+        {
+            removedFiles = 0;
+        }
+        if(ownTransaction)
+        {
+            if(succeeded)
+            {
+                database.commit();
+            }
+            else
+            {
+                database.rollback();
+            }
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::deleteDirectoryEntries() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return removedFiles;
+}
+
+QHash<QString, qint64> ZSDatabase::fetchFileTimestamps(QString path)
+{
+    QString prefix = path + "/";
+    QHash<QString, qint64> timestamps;
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("SELECT path, timestamp FROM files WHERE substr(path, 1, length(:prefix1)) = :prefix2 AND deleted = 0");
+        query.bindValue(":prefix1", prefix);
+        query.bindValue(":prefix2", prefix);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::fetchFileTimestamps() failed to execute query: " << query.lastError().text();
+        }
+        while(query.next())
+        {
+            timestamps.insert(query.value(0).toString(), query.value(1).toLongLong());
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchFileTimestamps() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return timestamps;
+}
+
+QSqlQuery ZSDatabase::fetchDirectoryChanges()
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        if(!query.exec("SELECT path, newpath, operation, timestamp, rowid FROM directorychanges ORDER BY rowid"))
+        {
+            qDebug() << "Error - ZSDatabase::fetchDirectoryChanges() failed to execute query: " << query.lastError().text();
+        }
+        mutex.unlock();
+        return query;
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::fetchDirectoryChanges() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+    return QSqlQuery();
+}
+
+void ZSDatabase::removeDirectoryChanges(qint64 lastRow)
+{
+    mutex.lock();
+    if(openDatabase())
+    {
+        QSqlQuery query(database);
+        query.prepare("DELETE FROM directorychanges WHERE rowid <= :lastRow");
+        query.bindValue(":lastRow", lastRow);
+        if(!query.exec())
+        {
+            qDebug() << "Error - ZSDatabase::removeDirectoryChanges() failed to execute query: " << query.lastError().text();
+        }
+    }
+    else
+    {
+        qDebug() << "Error - ZSDatabase::removeDirectoryChanges() failed: " << database.lastError().text();
+    }
+    mutex.unlock();
+}
 
 void ZSDatabase::resetFileMetaData()
 {
     mutex.lock();
-    if(database.open())
+    if(openDatabase())
     {
         QSqlQuery query(database);
-        query.prepare("UPDATE files SET changed = 0, updated = 0, changed_self = 0 WHERE changed = 1");
+        query.prepare("UPDATE files SET changed = 0, updated = 0, changed_self = 0, appended = 0 WHERE changed = 1");
         if(!query.exec())
         {
             qDebug() << "Error - ZSDatabase::resetFileMetaData() failed to execute query: " << query.lastError().text();
@@ -36,13 +36,22 @@
 #include <QtDebug>
 #include <QSqlError>
 #include <QMutex>
+#include <QAtomicInteger>
+#include <QDateTime>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QThread>
+#include <QElapsedTimer>
+#include "zschunker.h"
 
 
 //!  Class that provides the ZeroSync local database functionality
 /*!
   This class provides an interface to the local SQLite database, that is used
   to save the current ZeroSync folder status and the file index, that is used to
-  synchronize files between clients.
+  synchronize files between clients. Every thread that calls it, like the inotify
+  thread and the connector worker, uses a connection of its own.
 */
 class ZSDatabase : public QObject
 {
@@ -77,7 +86,7 @@ public:
         mutex.unlock();
     }
 //    explicit ZSDatabase(QObject *parent = 0);
-    void insertNewFile(QString, qint64, QString, qint64);
+    void insertNewFile(QString, qint64, QString, qint64, int = 0, int = 0);
     void setFileMetaData(QString, qint64, QString, qint64);
     void setFileChanged(QString, int);
     void setFileUpdated(QString, int);
@@ -87,6 +96,7 @@ public:
     void setFileTimestamp(QString, qint64);
     void setFileChangedSelf(QString, int);
     void setNewPath(QString, QString);
+    void renameFileEntry(QString, QString);
     QString getFilePathForHash(QString);
     void setFileHashToZero(QString);
     bool isFileChanged(QString);
@@ -102,12 +112,118 @@ public:
     QSqlQuery fetchFileByPath(QString path);
     QSqlQuery fetchUpdate(int);
     QSqlQuery fetchUpdateFromState(int fromState);
+
+    //!  FetchNetUpdatePage-Method
+    /*!
+      Returns up to limit index entries after fromState up to toState that are not
+      superseded by a later update or delete of the same path, ordered by state and
+      row. The next page continues after the state and rowid (column 7) of the last
+      entry. An update is only superseded if its path, or a directory above it, was
+      not renamed or deleted in between.
+    */
+    QSqlQuery fetchNetUpdatePage(int fromState, int toState, int afterState, qint64 afterRow, int limit);
     void insertNewIndexEntry(int, QString, QString, qint64, qint64, QString, QString, int);
     int getLatestState();
     void resetFileMetaData();
     void deleteAllRowsFromFilesTable();
     void setZeroSyncFolderChangedFlagToFileIndexTable();
     qint64 getTimestampForFile(QString);
+    int getLatestScanGeneration();
+
+    //!  NextScanGeneration-Method
+    /*!
+      Returns the generation of a new scan, one more than the previous one or, on the
+      first call, than the highest one stored. Files inserted, renamed or revived by
+      the watcher are stamped with at least this generation, so a running scan does
+      not sweep entries written after it started.
+    */
+    int nextScanGeneration();
+    int getScanGeneration();
+    bool markFileVisited(QString, int);
+    int markUnvisitedFilesDeleted(int, QString, bool);
+    //!  Starts a transaction that is written as one
+    /*!
+      The mutex stays locked by the calling thread until commitTransaction(), other threads
+      wait for it there instead of spinning in the busy handler of their own connection.
+    */
+    void beginTransaction();
+    void commitTransaction();
+    //!  Commits a long running transaction and starts a new one, so other threads get their turn
+    void yieldTransaction();
+    QSqlQuery fetchAllDirectories();
+    void setDirectoryScanned(QString, qint64, int);
+    void markDirectoryVisited(QString, int);
+
+    //!  MarkDirectoryUnread-Method
+    /*!
+      Stamps all entries below a directory that could not be read with the generation,
+      so the sweep keeps them, and forgets its modification time, so it is read again.
+    */
+    void markDirectoryUnread(QString, int);
+    QStringList removeUnvisitedDirectories(int);
+    bool isCleanShutdown();
+    void setCleanShutdown(bool);
+
+    //!  GetLastFullScanTime-Method
+    /*!
+      Returns the UTC milliseconds of the last scan that read every directory, 0 if there was none.
+    */
+    qint64 getLastFullScanTime();
+    void setLastFullScanTime(qint64);
+    void resetScanState();
+    void setFileChunks(QString, const QList<ZSChunk> &);
+    QList<ZSChunk> getFileChunks(QString);
+    QSqlQuery fetchChunksWithHash(QString);
+    void removeStaleContentData();
+    void setFileHashState(QString, qint64, QString, QByteArray);
+    bool getFileHashState(QString, qint64 &, QString &, QByteArray &);
+    void removeFileHashState(QString);
+    void setFileAppended(QString, bool);
+
+    //!  GetFilePathForChecksumPrefix-Method
+    /*!
+      Returns a present file of the size whose checksum starts with the hex prefix,
+      as announced by peers, or an empty string.
+    */
+    QString getFilePathForChecksumPrefix(QString, qint64);
+    void setTransfer(QString, qint64, QString, QByteArray);
+    void removeTransfer(QString);
+    QSqlQuery fetchAllTransfers();
+
+    //!  RenameDirectoryEntries-Method
+    /*!
+      Moves the entries of all files below the directory to the new directory in one
+      transaction, the files are not flagged as renamed. With announce the rename is
+      recorded for the index if any file was moved. Returns the number of moved files.
+    */
+    int renameDirectoryEntries(QString, QString, bool);
+
+    //!  DeleteDirectoryEntries-Method
+    /*!
+      Removes the entries of all files below the directory in one transaction. With
+      announce the delete is recorded for the index if the directory held files that
+      were not announced as deleted yet. Returns the number of removed files.
+    */
+    int deleteDirectoryEntries(QString, bool);
+
+    //!  FetchFileTimestamps-Method
+    /*!
+      Returns the timestamps of the present files below the directory by path.
+    */
+    QHash<QString, qint64> fetchFileTimestamps(QString);
+
+    //!  FetchDirectoryChanges-Method
+    /*!
+      Returns the recorded directory operations: path, newpath, operation, timestamp, rowid.
+    */
+    QSqlQuery fetchDirectoryChanges();
+    void removeDirectoryChanges(qint64);
+
+    //!  GetOperationCount-Method
+    /*!
+      Returns the number of database operations since startup, used by the benchmarks.
+    */
+    quint64 getOperationCount();
 
 private:
     //!  "Disabled" Constructor
@@ -135,9 +251,30 @@ private:
     static ZSDatabase* m_Instance;
     QMutex mutex;
 
+    //!  Milliseconds a connection waits for the write lock held by another process
+    static const int BUSY_TIMEOUT = 30000;
+    //!  Milliseconds a transaction keeps the other threads waiting before yieldTransaction() commits it
+    static const int MAXIMUM_TRANSACTION_TIME = 200;
+    QElapsedTimer transactionTimer;
+
+    //!  Generation of the running scan
+    /*!
+      Loaded from the tables once, afterwards it is only counted up in memory, so a
+      targeted rescan does not scan both tables for the highest generation.
+    */
+    int scanGeneration;
+    bool scanGenerationLoaded;
+
+    //!  Connection of the thread that called openDatabase() last
     QSqlDatabase database;
+    QThread *connectionThread;
+    QHash<QThread*, QSqlDatabase> connections;
+    QAtomicInteger<quint64> operationCount;
+    bool openDatabase();
     QString getDataBasePath();
     void createTables();
+    void upgradeTables();
+    void executeSqlResource(QString);
     bool tablesCreated();
 
 signals:
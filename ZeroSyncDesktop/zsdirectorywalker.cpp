@@ -0,0 +1,513 @@
+/* =========================================================================
+   ZSDirectoryWalker - Parallel directory traversal for the ZeroSync scanner
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsdirectorywalker.h"
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+
+// Layout of the records returned by getdents64
+struct linux_dirent64
+{
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+// Number of entries handed to the consumer at once
+static const int BATCH_SIZE = 512;
+
+// Batches that may wait for the consumer before the workers are throttled
+static const int MAXIMUM_PENDING_BATCHES = 64;
+
+// Modifications this close to the last scan can not be told apart by the timestamp
+static const qint64 RACY_INTERVAL = 2000;
+
+#ifdef Q_OS_LINUX
+#ifdef STATX_BASIC_STATS
+// Set once statx turned out to be missing at runtime or blocked, e.g. by the seccomp filter of a container
+static QAtomicInt statxUnavailable(0);
+#endif
+
+static bool statEntry(int directoryDescriptor, const char *name, mode_t &mode, ZSDirectoryEntry &entry)
+{
+#ifdef STATX_BASIC_STATS
+    if(!statxUnavailable.load())
+    {
+        struct statx extendedInformation;
+        if(statx(directoryDescriptor, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE | STATX_MTIME, &extendedInformation) == 0)
+        {
+            mode = extendedInformation.stx_mode;
+            entry.size = extendedInformation.stx_size;
+            entry.lastModified = (qint64) extendedInformation.stx_mtime.tv_sec * 1000 + extendedInformation.stx_mtime.tv_nsec / 1000000;
+            return true;
+        }
+        if(errno != ENOSYS && errno != EPERM)
+        {
+            return false;
+        }
+        statxUnavailable.store(1);
+    }
+#endif
+    struct stat information;
+    if(fstatat(directoryDescriptor, name, &information, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return false;
+    }
+    mode = information.st_mode;
+    entry.size = information.st_size;
+    entry.lastModified = (qint64) information.st_mtim.tv_sec * 1000 + information.st_mtim.tv_nsec / 1000000;
+    return true;
+}
+#endif
+
+
+class ZSDirectoryWalkerThread : public QThread
+{
+public:
+    ZSDirectoryWalkerThread(ZSDirectoryWalker *walker, int worker) :
+        walker(walker),
+        worker(worker)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        walker->work(worker);
+    }
+
+private:
+    ZSDirectoryWalker *walker;
+    int worker;
+};
+
+
+ZSDirectoryWalker::ZSDirectoryWalker(QObject *parent, int threadCount) :
+    QObject(parent),
+    threadCount(qMax(threadCount, 1)),
+    recursive(true),
+    pendingDirectories(0),
+    cancelled(0),
+    runningWorkers(0)
+{
+    for(int i = 0; i < this->threadCount; i++)
+    {
+        workQueues.append(new WorkQueue());
+    }
+}
+
+
+ZSDirectoryWalker::~ZSDirectoryWalker()
+{
+    stop();
+    qDeleteAll(workQueues);
+}
+
+
+void ZSDirectoryWalker::start(QString pathToDirectory, bool recursive)
+{
+    stop();
+    this->recursive = recursive;
+    cancelled.store(0);
+    results.clear();
+    failedDirectories.clear();
+
+    pendingDirectories.store(1);
+    WorkItem root;
+    root.path = pathToDirectory.toLocal8Bit();
+    root.read = true;
+    workQueues[0]->directories.append(root);
+
+    runningWorkers = threadCount;
+    for(int i = 0; i < threadCount; i++)
+    {
+        QThread *worker = new ZSDirectoryWalkerThread(this, i);
+        workers.append(worker);
+        worker->start();
+    }
+}
+
+
+void ZSDirectoryWalker::setKnownDirectories(const QHash<QByteArray, ZSKnownDirectory> &knownDirectories)
+{
+    this->knownDirectories = knownDirectories;
+}
+
+
+bool ZSDirectoryWalker::nextBatch(QVector<ZSDirectoryEntry> &batch)
+{
+    QMutexLocker locker(&resultMutex);
+    while(results.isEmpty() && runningWorkers > 0)
+    {
+        resultAvailable.wait(&resultMutex);
+    }
+    if(results.isEmpty())
+    {
+        return false;
+    }
+    batch = results.dequeue();
+    resultConsumed.wakeOne();
+    return true;
+}
+
+
+QStringList ZSDirectoryWalker::getFailedDirectories()
+{
+    QMutexLocker locker(&resultMutex);
+    QStringList directories;
+    foreach(const QByteArray &directory, failedDirectories)
+    {
+        directories.append(QString::fromLocal8Bit(directory));
+    }
+    return directories;
+}
+
+
+void ZSDirectoryWalker::addFailedDirectory(const QByteArray &directory)
+{
+    QMutexLocker locker(&resultMutex);
+    failedDirectories.append(directory);
+}
+
+
+void ZSDirectoryWalker::stop()
+{
+    cancelled.store(1);
+    resultMutex.lock();
+    resultConsumed.wakeAll();
+    resultMutex.unlock();
+    foreach(QThread *worker, workers)
+    {
+        worker->wait();
+    }
+    qDeleteAll(workers);
+    workers.clear();
+    foreach(WorkQueue *workQueue, workQueues)
+    {
+        workQueue->directories.clear();
+    }
+}
+
+
+void ZSDirectoryWalker::work(int worker)
+{
+    WorkItem directory;
+    int idleRounds = 0;
+    while(pendingDirectories.load() > 0 && !cancelled.load())
+    {
+        if(popDirectory(worker, directory))
+        {
+            if(directory.read)
+            {
+                readDirectory(worker, directory.path);
+            }
+            else
+            {
+                visitUnchangedDirectory(worker, directory.path);
+            }
+            pendingDirectories.deref();
+            idleRounds = 0;
+        }
+        else if(++idleRounds < 64)
+        {
+            QThread::yieldCurrentThread();
+        }
+        else
+        {
+            // Other workers are still reading, but have nothing to steal yet
+            QThread::usleep(100);
+        }
+    }
+
+    resultMutex.lock();
+    runningWorkers--;
+    resultAvailable.wakeAll();
+    resultMutex.unlock();
+}
+
+
+bool ZSDirectoryWalker::popDirectory(int worker, WorkItem &directory)
+{
+    // Own queue from the back keeps the traversal depth first and cache friendly
+    WorkQueue *ownQueue = workQueues[worker];
+    ownQueue->mutex.lock();
+    if(!ownQueue->directories.isEmpty())
+    {
+        directory = ownQueue->directories.takeLast();
+        ownQueue->mutex.unlock();
+        return true;
+    }
+    ownQueue->mutex.unlock();
+
+    // Steal from the front, where the directories closest to the root are
+    for(int i = 1; i < threadCount; i++)
+    {
+        WorkQueue *victimQueue = workQueues[(worker + i) % threadCount];
+        victimQueue->mutex.lock();
+        if(!victimQueue->directories.isEmpty())
+        {
+            directory = victimQueue->directories.takeFirst();
+            victimQueue->mutex.unlock();
+            return true;
+        }
+        victimQueue->mutex.unlock();
+    }
+    return false;
+}
+
+
+void ZSDirectoryWalker::pushDirectory(int worker, const QByteArray &directory, bool read)
+{
+    WorkItem item;
+    item.path = directory;
+    item.read = read;
+    pendingDirectories.ref();
+    WorkQueue *ownQueue = workQueues[worker];
+    ownQueue->mutex.lock();
+    ownQueue->directories.append(item);
+    ownQueue->mutex.unlock();
+}
+
+
+bool ZSDirectoryWalker::isUnchanged(const QByteArray &path, qint64 lastModified) const
+{
+    QHash<QByteArray, ZSKnownDirectory>::const_iterator known = knownDirectories.constFind(path);
+    return known != knownDirectories.constEnd()
+            && known->lastModified == lastModified
+            && lastModified + RACY_INTERVAL < known->scanned;
+}
+
+
+void ZSDirectoryWalker::addDirectoryEntry(int worker, const QByteArray &path, ZSDirectoryEntry &entry)
+{
+    entry.path = QString::fromLocal8Bit(path);
+    entry.unchanged = entry.isDir && isUnchanged(path, entry.lastModified);
+    if(entry.isDir && recursive)
+    {
+        pushDirectory(worker, path, !entry.unchanged);
+    }
+}
+
+
+#ifdef Q_OS_LINUX
+void ZSDirectoryWalker::readDirectory(int worker, const QByteArray &directory)
+{
+    int directoryDescriptor = open(directory.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directoryDescriptor < 0)
+    {
+        addFailedDirectory(directory);
+        return;
+    }
+
+    char buffer[64 * 1024] __attribute__ ((aligned(8)));
+    QVector<ZSDirectoryEntry> batch;
+    batch.reserve(BATCH_SIZE);
+    bool failed = false;
+
+    for(;;)
+    {
+        long count = syscall(SYS_getdents64, directoryDescriptor, buffer, sizeof(buffer));
+        if(count < 0)
+        {
+            failed = true;
+        }
+        if(count <= 0)
+        {
+            break;
+        }
+
+        for(long offset = 0; offset < count; )
+        {
+            struct linux_dirent64 *directoryEntry = (struct linux_dirent64 *) (buffer + offset);
+            offset += directoryEntry->d_reclen;
+
+            // Skips ".", ".." and hidden entries
+            const char *name = directoryEntry->d_name;
+            if(name[0] == '.')
+            {
+                continue;
+            }
+
+            mode_t mode;
+            ZSDirectoryEntry entry;
+            if(!statEntry(directoryDescriptor, name, mode, entry))
+            {
+                // Only an entry removed since it was listed is known to be gone
+                failed = failed || errno != ENOENT;
+                continue;
+            }
+            // Symbolic links, sockets, fifos and devices are not synchronized
+            if(!S_ISDIR(mode) && !S_ISREG(mode))
+            {
+                continue;
+            }
+
+            entry.isDir = S_ISDIR(mode);
+            addDirectoryEntry(worker, directory + '/' + name, entry);
+            batch.append(entry);
+            if(batch.size() >= BATCH_SIZE)
+            {
+                publish(batch);
+            }
+        }
+    }
+    close(directoryDescriptor);
+    if(failed)
+    {
+        addFailedDirectory(directory);
+    }
+
+    if(!batch.isEmpty())
+    {
+        publish(batch);
+    }
+}
+
+
+void ZSDirectoryWalker::visitUnchangedDirectory(int worker, const QByteArray &directory)
+{
+    // Entries of an unchanged directory are the same as before, only the known
+    // subdirectories have to be checked since they may have changed themselves
+    QList<QByteArray> subdirectories = knownDirectories.value(directory).subdirectories;
+    if(subdirectories.isEmpty())
+    {
+        return;
+    }
+
+    int directoryDescriptor = open(directory.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directoryDescriptor < 0)
+    {
+        addFailedDirectory(directory);
+        return;
+    }
+
+    QVector<ZSDirectoryEntry> batch;
+    foreach(const QByteArray &name, subdirectories)
+    {
+        mode_t mode;
+        ZSDirectoryEntry entry;
+        if(!statEntry(directoryDescriptor, name.constData(), mode, entry))
+        {
+            if(errno != ENOENT)
+            {
+                addFailedDirectory(directory + '/' + name);
+            }
+            continue;
+        }
+        if(!S_ISDIR(mode))
+        {
+            continue;
+        }
+        entry.isDir = true;
+        addDirectoryEntry(worker, directory + '/' + name, entry);
+        batch.append(entry);
+    }
+    close(directoryDescriptor);
+
+    if(!batch.isEmpty())
+    {
+        publish(batch);
+    }
+}
+#else
+void ZSDirectoryWalker::readDirectory(int worker, const QByteArray &directory)
+{
+    QVector<ZSDirectoryEntry> batch;
+    if(!QFileInfo(QString::fromLocal8Bit(directory)).isReadable())
+    {
+        addFailedDirectory(directory);
+        return;
+    }
+    QFileInfoList entries = QDir(QString::fromLocal8Bit(directory)).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+    foreach(QFileInfo fileInfo, entries)
+    {
+        ZSDirectoryEntry entry;
+        entry.isDir = fileInfo.isDir();
+        entry.size = fileInfo.size();
+        entry.lastModified = fileInfo.lastModified().toUTC().toMSecsSinceEpoch();
+        addDirectoryEntry(worker, fileInfo.absoluteFilePath().toLocal8Bit(), entry);
+
+        batch.append(entry);
+        if(batch.size() >= BATCH_SIZE)
+        {
+            publish(batch);
+        }
+    }
+
+    if(!batch.isEmpty())
+    {
+        publish(batch);
+    }
+}
+
+
+void ZSDirectoryWalker::visitUnchangedDirectory(int worker, const QByteArray &directory)
+{
+    QVector<ZSDirectoryEntry> batch;
+    foreach(const QByteArray &name, knownDirectories.value(directory).subdirectories)
+    {
+        QByteArray path = directory + '/' + name;
+        QFileInfo fileInfo(QString::fromLocal8Bit(path));
+        if(!fileInfo.isDir() || fileInfo.isSymLink())
+        {
+            continue;
+        }
+
+        ZSDirectoryEntry entry;
+        entry.isDir = true;
+        entry.size = fileInfo.size();
+        entry.lastModified = fileInfo.lastModified().toUTC().toMSecsSinceEpoch();
+        addDirectoryEntry(worker, path, entry);
+        batch.append(entry);
+    }
+
+    if(!batch.isEmpty())
+    {
+        publish(batch);
+    }
+}
+#endif
+
+
+void ZSDirectoryWalker::publish(QVector<ZSDirectoryEntry> &batch)
+{
+    QMutexLocker locker(&resultMutex);
+    // Throttle the workers if the consumer falls behind
+    while(results.size() >= MAXIMUM_PENDING_BATCHES && !cancelled.load())
+    {
+        resultConsumed.wait(&resultMutex);
+    }
+    results.enqueue(batch);
+    resultAvailable.wakeOne();
+    batch.clear();
+    batch.reserve(BATCH_SIZE);
+}
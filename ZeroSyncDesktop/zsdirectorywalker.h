@@ -0,0 +1,178 @@
+/* =========================================================================
+   ZSDirectoryWalker - Parallel directory traversal for the ZeroSync scanner
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSDIRECTORYWALKER_H
+#define ZSDIRECTORYWALKER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QVector>
+#include <QQueue>
+#include <QList>
+#include <QStringList>
+#include <QHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QtDebug>
+
+
+//!  Entry that was found by the directory walker
+/*!
+  Holds the metadata of a file or directory as it was returned by the stat call
+  of the walker, so the scanner does not need to stat it again.
+*/
+struct ZSDirectoryEntry
+{
+    QString path;
+    bool isDir;
+    qint64 size;
+    qint64 lastModified;
+
+    //!  Set for directories that were not modified since the last scan and not read
+    bool unchanged;
+};
+
+
+//!  Directory that is known from the last scan
+/*!
+  Holds the modification time a directory had when it was read last and the names
+  of its subdirectories, so an unchanged directory can be skipped without losing
+  the way to its children.
+*/
+struct ZSKnownDirectory
+{
+    qint64 lastModified;
+    qint64 scanned;
+    QList<QByteArray> subdirectories;
+};
+
+class ZSDirectoryWalkerThread;
+
+
+//!  Class that traverses a directory tree with multiple threads
+/*!
+  Every worker thread owns a queue of directories. It takes work from the back
+  of its own queue and steals from the front of the others when it ran dry. On
+  Linux directories are read with getdents64 into large buffers and each entry
+  is stat-ed relative to the open directory. The found entries are streamed in
+  batches to the consumer calling nextBatch().
+*/
+class ZSDirectoryWalker : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor. Uses one worker thread per core by default.
+    */
+    explicit ZSDirectoryWalker(QObject *parent = 0, int threadCount = QThread::idealThreadCount());
+
+    //!  Destructor
+    /*!
+      Stops and joins the worker threads.
+    */
+    ~ZSDirectoryWalker();
+
+    //!  Start-Method
+    /*!
+      Starts the traversal of the directory, including all subdirectories if recursive
+      is set. Hidden entries and symbolic links are skipped like QDirIterator does.
+    */
+    void start(QString pathToDirectory, bool recursive = true);
+
+    //!  SetKnownDirectories-Method
+    /*!
+      Sets the directories of the last scan, keyed by absolute path. Directories with
+      an unchanged modification time are not read, only their known subdirectories
+      are visited. The root directory is always read.
+    */
+    void setKnownDirectories(const QHash<QByteArray, ZSKnownDirectory> &knownDirectories);
+
+    //!  NextBatch-Method
+    /*!
+      Blocks until the next batch of entries is available. Returns false once the
+      traversal is complete and every batch was handed out.
+    */
+    bool nextBatch(QVector<ZSDirectoryEntry> &batch);
+
+    //!  GetFailedDirectories-Method
+    /*!
+      Returns the directories that could not be read completely, their content is
+      unknown. Complete once nextBatch() returned false.
+    */
+    QStringList getFailedDirectories();
+
+private:
+    friend class ZSDirectoryWalkerThread;
+
+    struct WorkItem
+    {
+        QByteArray path;
+        bool read;
+    };
+
+    struct WorkQueue
+    {
+        QMutex mutex;
+        QList<WorkItem> directories;
+    };
+
+    QVector<WorkQueue*> workQueues;
+    QList<QThread*> workers;
+    int threadCount;
+    bool recursive;
+    QHash<QByteArray, ZSKnownDirectory> knownDirectories;
+
+    //!  Directories that were queued but not read completely yet
+    QAtomicInt pendingDirectories;
+    QAtomicInt cancelled;
+
+    QMutex resultMutex;
+    QWaitCondition resultAvailable;
+    QWaitCondition resultConsumed;
+    QQueue<QVector<ZSDirectoryEntry> > results;
+    int runningWorkers;
+    QList<QByteArray> failedDirectories;
+
+    void work(int worker);
+    void stop();
+    bool popDirectory(int worker, WorkItem &directory);
+    void pushDirectory(int worker, const QByteArray &directory, bool read);
+    void readDirectory(int worker, const QByteArray &directory);
+    void visitUnchangedDirectory(int worker, const QByteArray &directory);
+    void addDirectoryEntry(int worker, const QByteArray &path, ZSDirectoryEntry &entry);
+    bool isUnchanged(const QByteArray &path, qint64 lastModified) const;
+    void publish(QVector<ZSDirectoryEntry> &batch);
+    void addFailedDirectory(const QByteArray &directory);
+};
+
+#endif // ZSDIRECTORYWALKER_H
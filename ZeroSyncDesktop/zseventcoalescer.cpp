@@ -0,0 +1,114 @@
+/* =========================================================================
+   ZSEventCoalescer - Per-path debouncing of filesystem change events
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zseventcoalescer.h"
+
+ZSEventCoalescer::ZSEventCoalescer(QObject *parent, int quietWindow) :
+    QObject(parent),
+    quietWindow(quietWindow),
+    maximumWindow(quietWindow * 16),
+    maximumDelay(quietWindow * 120)
+{
+}
+
+
+void ZSEventCoalescer::addEvent(QString path, qint64 now)
+{
+    QHash<QString, PendingPath>::iterator pending = pendingPaths.find(path);
+    if(pending == pendingPaths.end())
+    {
+        PendingPath newPending;
+        newPending.firstEvent = now;
+        newPending.lastEvent = now;
+        newPending.window = quietWindow;
+        pendingPaths.insert(path, newPending);
+        return;
+    }
+
+    // Path is busy for longer than its window, stretch it
+    if(now - pending->firstEvent > pending->window)
+    {
+        pending->window = qMin(pending->window * 2, maximumWindow);
+    }
+    pending->lastEvent = now;
+}
+
+
+bool ZSEventCoalescer::removePath(QString path)
+{
+    return pendingPaths.remove(path) > 0;
+}
+
+
+QStringList ZSEventCoalescer::takeSettledPaths(qint64 now)
+{
+    QStringList settledPaths;
+    QMutableHashIterator<QString, PendingPath> iterator(pendingPaths);
+    while(iterator.hasNext())
+    {
+        iterator.next();
+        if(settleTime(iterator.value()) <= now)
+        {
+            settledPaths.append(iterator.key());
+            iterator.remove();
+        }
+    }
+    return settledPaths;
+}
+
+
+int ZSEventCoalescer::msecsUntilNextSettle(qint64 now)
+{
+    if(pendingPaths.isEmpty())
+    {
+        return -1;
+    }
+
+    qint64 nextSettle = -1;
+    QHashIterator<QString, PendingPath> iterator(pendingPaths);
+    while(iterator.hasNext())
+    {
+        iterator.next();
+        qint64 time = settleTime(iterator.value());
+        if(nextSettle < 0 || time < nextSettle)
+        {
+            nextSettle = time;
+        }
+    }
+    return nextSettle > now ? (int) (nextSettle - now) : 0;
+}
+
+
+bool ZSEventCoalescer::isEmpty()
+{
+    return pendingPaths.isEmpty();
+}
+
+
+qint64 ZSEventCoalescer::settleTime(const PendingPath &pending)
+{
+    // A path that never goes quiet (e.g. a log file) is still flushed periodically
+    return qMin(pending.lastEvent + pending.window, pending.firstEvent + maximumDelay);
+}
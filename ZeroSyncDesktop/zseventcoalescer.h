@@ -0,0 +1,95 @@
+/* =========================================================================
+   ZSEventCoalescer - Per-path debouncing of filesystem change events
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSEVENTCOALESCER_H
+#define ZSEVENTCOALESCER_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+
+
+//!  Class that coalesces filesystem events per path
+/*!
+  This class sits between the raw filesystem watchers and the processing of
+  changes. Events for the same path are merged until the path was quiet for
+  its window. Paths that keep churning get their window stretched, so a file
+  produces one consolidated change once it settled instead of one per syscall.
+*/
+class ZSEventCoalescer : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor. The quiet window is given in milliseconds.
+    */
+    explicit ZSEventCoalescer(QObject *parent = 0, int quietWindow = 500);
+
+    //!  AddEvent-Method
+    /*!
+      Records an event for the path at the given time in milliseconds.
+    */
+    void addEvent(QString path, qint64 now);
+
+    //!  RemovePath-Method
+    /*!
+      Drops pending events for the path, e.g. when it got deleted or moved away.
+      Returns true if the path had pending events.
+    */
+    bool removePath(QString path);
+
+    //!  TakeSettledPaths-Method
+    /*!
+      Returns and forgets all paths that were quiet for their window.
+    */
+    QStringList takeSettledPaths(qint64 now);
+
+    //!  MsecsUntilNextSettle-Method
+    /*!
+      Returns the time until the next path settles or -1 if nothing is pending.
+    */
+    int msecsUntilNextSettle(qint64 now);
+
+    bool isEmpty();
+
+private:
+    struct PendingPath
+    {
+        qint64 firstEvent;
+        qint64 lastEvent;
+        int window;
+    };
+
+    QHash<QString, PendingPath> pendingPaths;
+    int quietWindow;
+    int maximumWindow;
+    int maximumDelay;
+
+    qint64 settleTime(const PendingPath &pending);
+};
+
+#endif // ZSEVENTCOALESCER_H
@@ -0,0 +1,81 @@
+/* =========================================================================
+   ZSExpectedWrites - Files written by the connector with known content
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsexpectedwrites.h"
+
+ZSExpectedWrites* ZSExpectedWrites::m_Instance = 0;
+
+ZSExpectedWrites::ZSExpectedWrites() :
+    nextPurge(0)
+{
+}
+
+
+void ZSExpectedWrites::expect(QString path, qint64 size, qint64 lastModified, QString checksum, QList<ZSChunk> chunks, bool changedSelf)
+{
+    QMutexLocker locker(&mutex);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // Entries the watcher never asked for, e.g. because the file was replaced right away
+    if(now >= nextPurge)
+    {
+        QMutableHashIterator<QString, ZSExpectedWrite> expired(expectedWrites);
+        while(expired.hasNext())
+        {
+            if(expired.next().value().expires < now)
+            {
+                expired.remove();
+            }
+        }
+        nextPurge = now + WINDOW;
+    }
+
+    ZSExpectedWrite expectedWrite;
+    expectedWrite.size = size;
+    expectedWrite.lastModified = lastModified;
+    expectedWrite.checksum = checksum;
+    expectedWrite.chunks = chunks;
+    expectedWrite.changedSelf = changedSelf;
+    expectedWrite.expires = now + WINDOW;
+    expectedWrites.insert(path, expectedWrite);
+}
+
+
+bool ZSExpectedWrites::take(QString path, QString absolutePath, ZSExpectedWrite &expectedWrite)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, ZSExpectedWrite>::iterator entry = expectedWrites.find(path);
+    if(entry == expectedWrites.end())
+    {
+        return false;
+    }
+    expectedWrite = entry.value();
+    expectedWrites.erase(entry);
+
+    QFileInfo file(absolutePath);
+    return expectedWrite.expires >= QDateTime::currentMSecsSinceEpoch()
+            && file.size() == expectedWrite.size
+            && file.lastModified().toUTC().toMSecsSinceEpoch() == expectedWrite.lastModified;
+}
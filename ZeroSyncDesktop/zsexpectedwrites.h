@@ -0,0 +1,144 @@
+/* =========================================================================
+   ZSExpectedWrites - Files written by the connector with known content
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSEXPECTEDWRITES_H
+#define ZSEXPECTEDWRITES_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QFileInfo>
+#include "zschunker.h"
+
+
+//!  Content of a file the connector is about to put in place
+struct ZSExpectedWrite
+{
+    qint64 size;
+    qint64 lastModified;
+    QString checksum;
+    QList<ZSChunk> chunks;
+    bool changedSelf;
+    qint64 expires;
+};
+
+
+//!  Class that remembers the files written by the connector
+/*!
+  The connector hashes a received file while it arrives and registers path, size,
+  modification time and checksum right before the file is moved into place. When
+  the watcher picks the file up, the hasher takes the registered checksum and
+  chunks instead of reading the file again. An entry only matches while size and
+  modification time are unchanged and for a short time, a file edited in between
+  is hashed as usual.
+*/
+class ZSExpectedWrites : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint64 WINDOW = 60 * 1000;
+
+    //!  GetInstance-Function
+    /*!
+      Static function that implements the Singleton functionality.
+    */
+    static ZSExpectedWrites* getInstance()
+    {
+        static QMutex mutex;
+        if (!m_Instance)
+        {
+            mutex.lock();
+            if (!m_Instance)
+            {
+                m_Instance = new ZSExpectedWrites();
+            }
+            mutex.unlock();
+        }
+        return m_Instance;
+    }
+
+    //!  DeleteInstance-Function
+    /*!
+      Static function that is used to delete the actual Singleton instance.
+    */
+    static void deleteInstance()
+    {
+        static QMutex mutex;
+        mutex.lock();
+        delete m_Instance;
+        m_Instance = 0;
+        mutex.unlock();
+    }
+
+    //!  Expect-Method
+    /*!
+      Registers the content of the path relative to the ZeroSync directory. With
+      changedSelf the file came from a peer and its entry is marked changed_self
+      when the watcher records it, so it is not announced back.
+    */
+    void expect(QString path, qint64 size, qint64 lastModified, QString checksum, QList<ZSChunk> chunks, bool changedSelf);
+
+    //!  Take-Method
+    /*!
+      Returns true and removes the entry of the path if the file at absolutePath still
+      has the registered size and modification time.
+    */
+    bool take(QString path, QString absolutePath, ZSExpectedWrite &expectedWrite);
+
+private:
+    //!  "Disabled" Constructor
+    /*!
+      Constructor that is set to private to implement the Singleton functionality.
+    */
+    ZSExpectedWrites();
+
+    //!  "Disabled" Constructor
+    /*!
+      Constructor that is set to private to implement the Singleton functionality.
+    */
+    ZSExpectedWrites(const ZSExpectedWrites &);
+
+    //!  "Disabled" Operator
+    /*!
+      Operator that is set to private to implement the Singleton functionality.
+    */
+    ZSExpectedWrites& operator=(const ZSExpectedWrites &);
+
+    //!  ZSExpectedWrites Singleton Instance
+    /*!
+      Instance that can be requested with the getInstance-Method.
+    */
+    static ZSExpectedWrites* m_Instance;
+
+    QHash<QString, ZSExpectedWrite> expectedWrites;
+    QMutex mutex;
+    qint64 nextPurge;
+};
+
+#endif // ZSEXPECTEDWRITES_H
@@ -0,0 +1,212 @@
+/* =========================================================================
+   ZSFileHandleCache - Cache of open file handles for serving chunks
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsfilehandlecache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Handles older than this are compared with the file at their path before they are used
+static const qint64 REVALIDATE_INTERVAL = 1000;
+
+static qint64 modificationTime(const struct stat &information)
+{
+    return (qint64) information.st_mtim.tv_sec * 1000000000 + information.st_mtim.tv_nsec;
+}
+
+
+ZSFileHandleCache::ZSFileHandleCache(QObject *parent, int capacity) :
+    QObject(parent),
+    capacity(qMax(capacity, 1)),
+    useCounter(0)
+{
+}
+
+
+ZSFileHandleCache::~ZSFileHandleCache()
+{
+    clear();
+}
+
+
+qint64 ZSFileHandleCache::read(QString path, char *data, qint64 length, qint64 offset)
+{
+    QMutexLocker locker(&mutex);
+    Handle *handle = findHandle(path);
+    if(!handle)
+    {
+        return -1;
+    }
+
+    qint64 total = 0;
+    while(total < length)
+    {
+        ssize_t count = pread(handle->descriptor, data + total, length - total, offset + total);
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count < 0)
+        {
+            qDebug() << "Error - ZSFileHandleCache::read() failed for" << path << ": " << strerror(errno);
+            return total > 0 ? total : -1;
+        }
+        if(count == 0)
+        {
+            break;
+        }
+        total += count;
+    }
+    return total;
+}
+
+
+void ZSFileHandleCache::invalidate(QString path)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Handle>::iterator handle = handles.find(path);
+    if(handle != handles.end())
+    {
+        closeHandle(*handle);
+        handles.erase(handle);
+    }
+}
+
+
+void ZSFileHandleCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    for(QHash<QString, Handle>::iterator handle = handles.begin(); handle != handles.end(); ++handle)
+    {
+        closeHandle(*handle);
+    }
+    handles.clear();
+}
+
+
+ZSFileHandleCache::Handle *ZSFileHandleCache::findHandle(QString path)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QHash<QString, Handle>::iterator handle = handles.find(path);
+    if(handle != handles.end() && now - handle->validated > REVALIDATE_INTERVAL)
+    {
+        if(isCurrent(*handle))
+        {
+            handle->validated = now;
+        }
+        else
+        {
+            closeHandle(*handle);
+            handles.erase(handle);
+            handle = handles.end();
+        }
+    }
+    if(handle == handles.end())
+    {
+        Handle newHandle;
+        if(!openHandle(path, newHandle))
+        {
+            return 0;
+        }
+        if(handles.size() >= capacity)
+        {
+            evictLeastRecentlyUsed();
+        }
+        handle = handles.insert(path, newHandle);
+    }
+    handle->lastUse = ++useCounter;
+    return &handle.value();
+}
+
+
+bool ZSFileHandleCache::openHandle(QString path, Handle &handle)
+{
+    // The settings are only consulted when a file is opened, not for every chunk
+    handle.absolutePath = ZSSettings::getInstance()->getZeroSyncDirectory().append("/").append(path).toLocal8Bit();
+    handle.descriptor = open(handle.absolutePath.constData(), O_RDONLY | O_CLOEXEC);
+    if(handle.descriptor < 0)
+    {
+        qDebug() << "Error - ZSFileHandleCache::openHandle() failed for" << path << ": " << strerror(errno);
+        return false;
+    }
+
+    struct stat information;
+    if(fstat(handle.descriptor, &information) != 0 || !S_ISREG(information.st_mode))
+    {
+        close(handle.descriptor);
+        return false;
+    }
+    handle.device = information.st_dev;
+    handle.inode = information.st_ino;
+    handle.size = information.st_size;
+    handle.lastModified = modificationTime(information);
+    handle.validated = QDateTime::currentMSecsSinceEpoch();
+    handle.lastUse = 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Chunks are requested front to back, so a large read ahead pays off
+    posix_fadvise(handle.descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return true;
+}
+
+
+void ZSFileHandleCache::closeHandle(Handle &handle)
+{
+    close(handle.descriptor);
+}
+
+
+bool ZSFileHandleCache::isCurrent(const Handle &handle)
+{
+    struct stat information;
+    if(stat(handle.absolutePath.constData(), &information) != 0)
+    {
+        return false;
+    }
+    return information.st_dev == handle.device && information.st_ino == handle.inode &&
+            information.st_size == handle.size && modificationTime(information) == handle.lastModified;
+}
+
+
+void ZSFileHandleCache::evictLeastRecentlyUsed()
+{
+    QHash<QString, Handle>::iterator leastRecentlyUsed = handles.begin();
+    for(QHash<QString, Handle>::iterator handle = handles.begin(); handle != handles.end(); ++handle)
+    {
+        if(handle->lastUse < leastRecentlyUsed->lastUse)
+        {
+            leastRecentlyUsed = handle;
+        }
+    }
+    if(leastRecentlyUsed != handles.end())
+    {
+        closeHandle(*leastRecentlyUsed);
+        handles.erase(leastRecentlyUsed);
+    }
+}
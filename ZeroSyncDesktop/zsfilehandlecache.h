@@ -0,0 +1,109 @@
+/* =========================================================================
+   ZSFileHandleCache - Cache of open file handles for serving chunks
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSFILEHANDLECACHE_H
+#define ZSFILEHANDLECACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QByteArray>
+#include <QDateTime>
+#include <QtDebug>
+#include <sys/types.h>
+#include "zssettings.h"
+
+
+//!  Class that keeps files open for reading chunks
+/*!
+  Peers request a file in many chunks. This class keeps the most recently used
+  files open and reads the chunks with pread, so a chunk costs one system call
+  instead of an open, a seek and a close. Handles are keyed on the path relative
+  to the ZeroSync directory and remember the identity of the file they opened. A
+  handle is dropped when the watcher reports a change of its path, and checked
+  against the path again if it was not validated for a while, so a replaced file
+  is never served from the old handle for long.
+
+  Files are not mapped into memory: their owner may truncate them at any time,
+  and touching a mapped page past the new end raises SIGBUS.
+*/
+class ZSFileHandleCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor. Capacity is the number of files kept open.
+    */
+    explicit ZSFileHandleCache(QObject *parent = 0, int capacity = 32);
+
+    //!  Destructor
+    /*!
+      Closes all handles.
+    */
+    ~ZSFileHandleCache();
+
+    //!  Read-Method
+    /*!
+      Reads up to length bytes at offset of the file into data. Returns the number
+      of bytes read, 0 at the end of the file or -1 if the file can't be read.
+    */
+    qint64 read(QString path, char *data, qint64 length, qint64 offset);
+
+    //!  Invalidate-Method
+    /*!
+      Closes the handle of the path, the next read opens the file again.
+    */
+    void invalidate(QString path);
+    void clear();
+
+private:
+    struct Handle
+    {
+        int descriptor;
+        QByteArray absolutePath;
+        dev_t device;
+        ino_t inode;
+        qint64 size;
+        qint64 lastModified;
+        qint64 validated;
+        quint64 lastUse;
+    };
+
+    QHash<QString, Handle> handles;
+    QMutex mutex;
+    int capacity;
+    quint64 useCounter;
+
+    Handle *findHandle(QString path);
+    bool openHandle(QString path, Handle &handle);
+    void closeHandle(Handle &handle);
+    bool isCurrent(const Handle &handle);
+    void evictLeastRecentlyUsed();
+};
+
+#endif // ZSFILEHANDLECACHE_H
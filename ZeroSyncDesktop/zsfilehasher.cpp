@@ -0,0 +1,249 @@
+/* =========================================================================
+   ZSFileHasher - Hashes files and continues the hash of files that grew
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsfilehasher.h"
+
+#include <sys/stat.h>
+
+QAtomicInteger<qint64> ZSFileHasher::hashedBytes(0);
+QMutex ZSFileHasher::evidenceMutex;
+bool ZSFileHasher::modificationsWatched = false;
+QHash<QString, ZSFileHasher::AppendEvidence> ZSFileHasher::evidence;
+
+// Files are hashed in blocks of this size instead of being read into memory at once
+static const int READ_BLOCK_SIZE = 1024 * 1024;
+
+// Bytes at the start and the end of the old content that are compared to detect a rewrite
+static const qint64 FINGERPRINT_SAMPLE = 4096;
+
+// Smaller files are hashed completely, they are read quickly and need no evidence kept in memory
+static const qint64 RESUME_THRESHOLD = 1024 * 1024;
+
+
+ZSFileHasher::ZSFileHasher(QObject *parent) :
+    QObject(parent),
+    append(false),
+    appendOffset(0),
+    changedSelf(false)
+{
+}
+
+
+QString ZSFileHasher::hashFile(QString absolutePath, QString relativePath)
+{
+    ZSSha3 sha3;
+    ZSChunker chunker;
+    chunks.clear();
+    append = false;
+    appendOffset = 0;
+    changedSelf = false;
+
+    // Files put in place by the connector were hashed while they arrived
+    ZSExpectedWrite expectedWrite;
+    if(!relativePath.isEmpty() && ZSExpectedWrites::getInstance()->take(relativePath, absolutePath, expectedWrite))
+    {
+        chunks = expectedWrite.chunks;
+        changedSelf = expectedWrite.changedSelf;
+        return expectedWrite.checksum;
+    }
+
+    QFile file(absolutePath);
+    file.open(QFile::ReadOnly);
+
+    // Content before this offset is only chunked, it is part of the resumed hash already
+    qint64 hashedSize = 0;
+    qint64 position = 0;
+    if(!relativePath.isEmpty() && resume(file, relativePath, sha3, chunker, position))
+    {
+        hashedSize = appendOffset;
+    }
+    file.seek(position);
+
+    QByteArray buffer(READ_BLOCK_SIZE, Qt::Uninitialized);
+    qint64 length;
+    while((length = file.read(buffer.data(), buffer.size())) > 0)
+    {
+        chunker.addData(buffer.constData(), length);
+        qint64 skip = qBound(Q_INT64_C(0), hashedSize - position, length);
+        sha3.addData(buffer.constData() + skip, length - skip);
+        hashedBytes.fetchAndAddRelaxed(length - skip);
+        position += length;
+    }
+    hashedSize = position;
+    chunks += chunker.takeChunks();
+
+    if(!relativePath.isEmpty() && file.isOpen())
+    {
+        // A file that shrank below the threshold must not keep the state of its larger past
+        if(hashedSize >= RESUME_THRESHOLD)
+        {
+            ZSDatabase::getInstance()->setFileHashState(relativePath, hashedSize, fingerprint(file, hashedSize), sha3.saveState());
+        }
+        else
+        {
+            ZSDatabase::getInstance()->removeFileHashState(relativePath);
+        }
+
+        // Modifications from now on decide whether the next hash may resume
+        struct stat information;
+        QMutexLocker locker(&evidenceMutex);
+        evidence.remove(relativePath);
+        if(modificationsWatched && hashedSize >= RESUME_THRESHOLD && fstat(file.handle(), &information) == 0)
+        {
+            AppendEvidence fileEvidence;
+            fileEvidence.device = information.st_dev;
+            fileEvidence.inode = information.st_ino;
+            fileEvidence.size = hashedSize;
+            fileEvidence.appendOnly = true;
+            evidence.insert(relativePath, fileEvidence);
+        }
+    }
+    return sha3.result().toHex();
+}
+
+
+QList<ZSChunk> ZSFileHasher::getChunks()
+{
+    return chunks;
+}
+
+
+bool ZSFileHasher::isAppend()
+{
+    return append;
+}
+
+
+qint64 ZSFileHasher::getAppendOffset()
+{
+    return appendOffset;
+}
+
+
+bool ZSFileHasher::isChangedSelf()
+{
+    return changedSelf;
+}
+
+
+qint64 ZSFileHasher::getHashedBytes()
+{
+    return hashedBytes.load();
+}
+
+
+void ZSFileHasher::setModificationsWatched(bool watched)
+{
+    QMutexLocker locker(&evidenceMutex);
+    modificationsWatched = watched;
+    evidence.clear();
+}
+
+
+void ZSFileHasher::noteModified(QString absolutePath, QString relativePath)
+{
+    QMutexLocker locker(&evidenceMutex);
+    QHash<QString, AppendEvidence>::iterator fileEvidence = evidence.find(relativePath);
+    if(fileEvidence == evidence.end() || !fileEvidence->appendOnly)
+    {
+        return;
+    }
+    // inotify does not tell where a file was written, a file that shrank was truncated and rewritten
+    struct stat information;
+    if(stat(absolutePath.toLocal8Bit().constData(), &information) != 0 || information.st_ino != fileEvidence->inode ||
+            information.st_dev != fileEvidence->device || information.st_size < fileEvidence->size)
+    {
+        fileEvidence->appendOnly = false;
+    }
+}
+
+
+void ZSFileHasher::forget(QString relativePath)
+{
+    QMutexLocker locker(&evidenceMutex);
+    evidence.remove(relativePath);
+}
+
+
+bool ZSFileHasher::resume(QFile &file, QString relativePath, ZSSha3 &sha3, ZSChunker &chunker, qint64 &position)
+{
+    qint64 previousSize;
+    QString previousFingerprint;
+    QByteArray state;
+    if(!file.isOpen() || !ZSDatabase::getInstance()->getFileHashState(relativePath, previousSize, previousFingerprint, state))
+    {
+        return false;
+    }
+    if(previousSize <= 0 || file.size() <= previousSize)
+    {
+        return false;
+    }
+    {
+        struct stat information;
+        QMutexLocker locker(&evidenceMutex);
+        QHash<QString, AppendEvidence>::const_iterator fileEvidence = evidence.constFind(relativePath);
+        if(fileEvidence == evidence.constEnd() || !fileEvidence->appendOnly || fileEvidence->size != previousSize ||
+                fstat(file.handle(), &information) != 0 || information.st_ino != fileEvidence->inode || information.st_dev != fileEvidence->device)
+        {
+            return false;
+        }
+    }
+    if(fingerprint(file, previousSize) != previousFingerprint)
+    {
+        return false;
+    }
+
+    // The last chunk only ended with the file, so chunking continues at its start
+    QList<ZSChunk> previousChunks = ZSDatabase::getInstance()->getFileChunks(relativePath);
+    if(previousChunks.isEmpty() || previousChunks.last().offset + previousChunks.last().length != previousSize)
+    {
+        return false;
+    }
+    if(!sha3.restoreState(state))
+    {
+        return false;
+    }
+
+    ZSChunk lastChunk = previousChunks.takeLast();
+    chunks = previousChunks;
+    chunker.setOffset(lastChunk.offset);
+    position = lastChunk.offset;
+    append = true;
+    appendOffset = previousSize;
+    return true;
+}
+
+
+QString ZSFileHasher::fingerprint(QFile &file, qint64 size)
+{
+    // Catches rewrites of the old content that happen to leave the file larger
+    QCryptographicHash cryptoHash(QCryptographicHash::Sha256);
+    cryptoHash.addData(QByteArray::number(size));
+    file.seek(0);
+    cryptoHash.addData(file.read(qMin(size, FINGERPRINT_SAMPLE)));
+    file.seek(qMax(Q_INT64_C(0), size - FINGERPRINT_SAMPLE));
+    cryptoHash.addData(file.read(qMin(size, FINGERPRINT_SAMPLE)));
+    return cryptoHash.result().toHex();
+}
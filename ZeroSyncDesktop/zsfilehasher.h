@@ -0,0 +1,146 @@
+/* =========================================================================
+   ZSFileHasher - Hashes files and continues the hash of files that grew
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSFILEHASHER_H
+#define ZSFILEHASHER_H
+
+#include <QObject>
+#include <QFile>
+#include <QList>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <sys/types.h>
+#include <QtDebug>
+#include "zssha3.h"
+#include "zschunker.h"
+#include "zsdatabase.h"
+#include "zsexpectedwrites.h"
+
+
+//!  Class that hashes files
+/*!
+  This class calculates the SHA3-512 hash and the content-defined chunks of a file
+  in one pass. For files known to the database it saves the hash state and a
+  fingerprint of the content. A large file is only resumed if the watcher saw every
+  modification since then, the file kept its inode, never was smaller than the
+  hashed size when it was modified and the fingerprint of the old content still
+  matches. Only the appended tail is read then and the change is reported as an
+  append, any other file is hashed completely.
+*/
+class ZSFileHasher : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSFileHasher(QObject *parent = 0);
+
+    //!  HashFile-Method
+    /*!
+      Returns the hex encoded hash of the file. If the path relative to the ZeroSync
+      directory is given, a saved hash state is resumed and the new state is saved.
+    */
+    QString hashFile(QString absolutePath, QString relativePath = QString());
+
+    QList<ZSChunk> getChunks();
+
+    //!  IsAppend-Method
+    /*!
+      Returns true if the last hashed file only had data appended since it was hashed before.
+    */
+    bool isAppend();
+
+    //!  GetAppendOffset-Method
+    /*!
+      Returns the size the file had before the append.
+    */
+    qint64 getAppendOffset();
+
+    //!  IsChangedSelf-Method
+    /*!
+      Returns true if the last hashed file was put in place by the connector, its
+      change came from a peer and must not be announced again.
+    */
+    bool isChangedSelf();
+
+    //!  GetHashedBytes-Method
+    /*!
+      Returns the number of bytes hashed since startup, used by the benchmarks.
+    */
+    static qint64 getHashedBytes();
+
+    //!  SetModificationsWatched-Method
+    /*!
+      Is called by the watcher when it starts or stops watching and after it lost
+      events. What was noted about the files so far is dropped.
+    */
+    static void setModificationsWatched(bool watched);
+
+    //!  NoteModified-Method
+    /*!
+      Is called by the watcher for every modification of a file, with its absolute
+      path and the path relative to the ZeroSync directory.
+    */
+    static void noteModified(QString absolutePath, QString relativePath);
+
+    //!  Forget-Method
+    /*!
+      Is called by the watcher when the file at the path was removed or replaced.
+    */
+    static void forget(QString relativePath);
+
+private:
+    static QAtomicInteger<qint64> hashedBytes;
+
+    //!  What the watcher saw of a file since its hash state was saved
+    struct AppendEvidence
+    {
+        dev_t device;
+        ino_t inode;
+        qint64 size;
+        bool appendOnly;
+    };
+
+    static QMutex evidenceMutex;
+    static bool modificationsWatched;
+    static QHash<QString, AppendEvidence> evidence;
+
+    QList<ZSChunk> chunks;
+    bool append;
+    qint64 appendOffset;
+    bool changedSelf;
+
+    bool resume(QFile &, QString, ZSSha3 &, ZSChunker &, qint64 &);
+    QString fingerprint(QFile &, qint64);
+};
+
+#endif // ZSFILEHASHER_H
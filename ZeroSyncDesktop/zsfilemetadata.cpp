@@ -26,19 +26,34 @@
 #include "zsfilemetadata.h"
 
 ZSFileMetaData::ZSFileMetaData(QObject *parent, QString path, QString pathToZeroSyncDirectory) :
-    QObject(parent)
+    QObject(parent),
+    appendOnly(false),
+    changedSelf(false)
 {
     updateFileMetaData(path, pathToZeroSyncDirectory);
 }
 
 
+ZSFileMetaData::ZSFileMetaData(QObject *parent, QString path, QString pathToZeroSyncDirectory, qint64 lastModified, qint64 size) :
+    QObject(parent),
+    filePath(path.mid(pathToZeroSyncDirectory.length() + 1)),
+    fileLastModified(lastModified),
+    appendOnly(false),
+    changedSelf(false),
+    fileSize(size),
+    absoluteFilePath(path)
+{
+}
+
+
 void ZSFileMetaData::updateFileMetaData(QString path, QString pathToZeroSyncDirectory)
 {
     QFileInfo fileInformations(path);
     filePath = fileInformations.absoluteFilePath().remove(0, pathToZeroSyncDirectory.length() + 1);
     fileLastModified = fileInformations.lastModified().toUTC().toMSecsSinceEpoch();
-    hashOfFile = calculateHash(path);
+    hashOfFile = QString();
     fileSize = fileInformations.size();
+    absoluteFilePath = path;
 }
 
 
@@ -56,10 +71,39 @@ qint64 ZSFileMetaData::getLastModified()
 
 QString ZSFileMetaData::getHash()
 {
+    if(hashOfFile.isNull())
+    {
+        ZSFileHasher fileHasher;
+        hashOfFile = fileHasher.hashFile(absoluteFilePath, filePath);
+        chunksOfFile = fileHasher.getChunks();
+        appendOnly = fileHasher.isAppend();
+        changedSelf = fileHasher.isChangedSelf();
+    }
     return hashOfFile;
 }
 
 
+QList<ZSChunk> ZSFileMetaData::getChunks()
+{
+    getHash();
+    return chunksOfFile;
+}
+
+
+bool ZSFileMetaData::isAppend()
+{
+    getHash();
+    return appendOnly;
+}
+
+
+bool ZSFileMetaData::isChangedSelf()
+{
+    getHash();
+    return changedSelf;
+}
+
+
 qint64 ZSFileMetaData::getFileSize()
 {
     return fileSize;
@@ -70,13 +114,3 @@ bool ZSFileMetaData::existsFile(QString path)
     QFileInfo checkForExistence(path);
     return checkForExistence.exists();
 }
-
-QString ZSFileMetaData::calculateHash(QString path)
-{
-    QCryptographicHash cryptoHash(QCryptographicHash::Sha3_512);
-    QFile file(path);
-    file.open(QFile::ReadOnly);
-    cryptoHash.addData(file.readAll());
-    QByteArray hashValue = cryptoHash.result();
-    return hashValue.toHex();
-}
@@ -33,6 +33,9 @@
 #include <QFile>
 #include <QByteArray>
 #include <QDateTime>
+#include <QList>
+#include "zschunker.h"
+#include "zsfilehasher.h"
 
 
 //!  Class that provides file informations
@@ -49,9 +52,33 @@ public:
       The default constructor.
     */
     explicit ZSFileMetaData(QObject *parent = 0, QString path = QString(), QString pathToZeroSyncDirectory = QString());
+
+    //!  Constructor
+    /*!
+      Constructor for files that were already stat-ed, e.g. by the directory walker.
+    */
+    ZSFileMetaData(QObject *parent, QString path, QString pathToZeroSyncDirectory, qint64 lastModified, qint64 size);
     QString getFilePath();
     qint64 getLastModified();
     QString getHash();
+
+    //!  GetChunks-Method
+    /*!
+      Returns the content-defined chunks, found in the same pass that calculates the hash.
+    */
+    QList<ZSChunk> getChunks();
+
+    //!  IsAppend-Method
+    /*!
+      Returns true if the file only had data appended since it was hashed last.
+    */
+    bool isAppend();
+
+    //!  IsChangedSelf-Method
+    /*!
+      Returns true if the file was received from a peer, see ZSFileHasher::isChangedSelf.
+    */
+    bool isChangedSelf();
     qint64 getFileSize();
     bool existsFile(QString);
 
@@ -59,10 +86,18 @@ private:
     QString filePath;
     qint64 fileLastModified;
     QString hashOfFile;
+    QList<ZSChunk> chunksOfFile;
+    bool appendOnly;
+    bool changedSelf;
     qint64 fileSize;
 
+    //!  Absolute path the hash is calculated from on the first request
+    /*!
+      Hashing reads the whole file, so it is deferred until somebody needs it.
+    */
+    QString absoluteFilePath;
+
     void updateFileMetaData(QString, QString);
-    QString calculateHash(QString);
 
 signals:
 
@@ -0,0 +1,253 @@
+/* =========================================================================
+   ZSFilePack - Transfers many small files as one unit
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsfilepack.h"
+#include <cstring>
+
+static const char PACK_PREFIX[] = ".zerosync/packs/";
+static const char PACK_MAGIC[] = "ZSP1";
+static const quint64 MISSING_ENTRY = Q_UINT64_C(0xFFFFFFFFFFFFFFFF);
+
+ZSFilePack::ZSFilePack(ZSStagingArea *stagingArea, QObject *parent) :
+    QObject(parent),
+    stagingArea(stagingArea),
+    built(32 * 1024)
+{
+}
+
+
+bool ZSFilePack::isPackPath(QString path)
+{
+    return path.startsWith(PACK_PREFIX);
+}
+
+
+QString ZSFilePack::packPath(QStringList paths)
+{
+    // Paths of synchronized files never contain a line break
+    return QString(PACK_PREFIX).append(paths.join('\n'));
+}
+
+
+qint64 ZSFilePack::entrySize(QString path, qint64 size)
+{
+    return ENTRY_HEADER_SIZE + path.toUtf8().size() + size;
+}
+
+
+bool ZSFilePack::read(QString packPath, qint64 offset, qint64 length, QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+    // The agent asks for the chunks one after another, the pack is built once for all of them
+    QByteArray *pack = built.object(packPath);
+    if(!pack)
+    {
+        pack = new QByteArray(build(packPath));
+        built.insert(packPath, pack, pack->size() / 1024 + 1);
+        pack = built.object(packPath);
+        if(!pack)
+        {
+            return false;
+        }
+    }
+    if(offset >= pack->size())
+    {
+        built.remove(packPath);
+        return false;
+    }
+    data = pack->mid(offset, length);
+    if(offset + data.size() >= pack->size())
+    {
+        built.remove(packPath);
+    }
+    return true;
+}
+
+
+QByteArray ZSFilePack::build(QString packPath)
+{
+    QStringList paths = packPath.mid(strlen(PACK_PREFIX)).split('\n');
+    QString syncDirectory = ZSSettings::getInstance()->getZeroSyncDirectory();
+    QByteArray pack(HEADER_SIZE, '\0');
+    memcpy(pack.data(), PACK_MAGIC, 4);
+    qToBigEndian<quint32>(paths.size(), (uchar *) pack.data() + 4);
+
+    foreach(const QString &path, paths)
+    {
+        QByteArray name = path.toUtf8();
+        QByteArray content;
+        quint64 size = MISSING_ENTRY;
+        quint64 checksum = 0;
+        QFile file(syncDirectory + "/" + path);
+        // A file that is gone or grew beyond an entry is left out, its next update follows
+        if(!path.startsWith('.') && !path.contains("/.") && file.open(QFile::ReadOnly) && file.size() <= MAXIMUM_ENTRY_SIZE)
+        {
+            content = file.readAll();
+            size = content.size();
+            ZSSha3 sha3;
+            sha3.addData(content.constData(), content.size());
+            checksum = ZSStagingArea::checksumPrefix(sha3.result().toHex());
+        }
+        else
+        {
+            qDebug() << "Error - ZSFilePack::build() failed to read" << path;
+        }
+
+        qint64 position = pack.size();
+        pack.resize(position + ENTRY_HEADER_SIZE);
+        uchar *header = (uchar *) pack.data() + position;
+        qToBigEndian<quint16>(name.size(), header);
+        qToBigEndian<quint64>(size, header + 2);
+        qToBigEndian<quint64>(checksum, header + 10);
+        pack.append(name);
+        pack.append(content);
+    }
+    qToBigEndian<quint64>(pack.size(), (uchar *) pack.data() + 8);
+    return pack;
+}
+
+
+void ZSFilePack::expectPack(QString packPath, QList<ZSPackEntry> entries)
+{
+    QMutexLocker locker(&mutex);
+    ReceivedPack pack;
+    pack.total = HEADER_SIZE;
+    foreach(const ZSPackEntry &entry, entries)
+    {
+        pack.entries.insert(entry.path, entry);
+        pack.total += entrySize(entry.path, entry.size);
+    }
+    // Until the header arrived the size follows from the announced sizes
+    pack.content.reserve(pack.total);
+    received.insert(packPath, pack);
+}
+
+
+bool ZSFilePack::writeChunk(QString packPath, qint64 offset, const char *data, qint64 length)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, ReceivedPack>::iterator pack = received.find(packPath);
+    // Files may have grown on the sender up to the entry limit, a pack never gets larger
+    qint64 limit = HEADER_SIZE + packPath.toUtf8().size() + MAXIMUM_ENTRIES * (ENTRY_HEADER_SIZE + MAXIMUM_ENTRY_SIZE);
+    if(pack == received.end() || offset < 0 || length < 0 || offset + length > limit)
+    {
+        return false;
+    }
+    if(pack->content.size() < offset + length)
+    {
+        pack->content.resize(offset + length);
+    }
+    memcpy(pack->content.data() + offset, data, length);
+    // Chunks received again after a retry must not count twice
+    ZSStagingArea::addRange(pack->ranges, offset, offset + length);
+
+    if(offset == 0 && length >= HEADER_SIZE)
+    {
+        if(memcmp(data, PACK_MAGIC, 4) != 0)
+        {
+            qDebug() << "Error - ZSFilePack::writeChunk() failed: Peer did not answer with a pack";
+            received.erase(pack);
+            return false;
+        }
+        pack->total = qFromBigEndian<quint64>((const uchar *) data + 8);
+    }
+    if(pack->ranges.isEmpty() || pack->ranges.constBegin().key() > 0 || pack->ranges.constBegin().value() < qMax(pack->total, (qint64) HEADER_SIZE))
+    {
+        return false;
+    }
+
+    ReceivedPack complete = pack.value();
+    received.erase(pack);
+    locker.unlock();
+    unpack(complete);
+    return true;
+}
+
+
+void ZSFilePack::unpack(ReceivedPack &pack)
+{
+    const uchar *content = (const uchar *) pack.content.constData();
+    qint64 length = qMin((qint64) pack.content.size(), pack.total);
+    qint64 position = HEADER_SIZE;
+    int count = qFromBigEndian<quint32>(content + 4);
+
+    // The database updates of all files are written with one commit
+    ZSDatabase::getInstance()->beginTransaction();
+    for(int i = 0; i < count && position + ENTRY_HEADER_SIZE <= length; i++)
+    {
+        const uchar *header = content + position;
+        qint64 nameLength = qFromBigEndian<quint16>(header);
+        quint64 size = qFromBigEndian<quint64>(header + 2);
+        quint64 checksum = qFromBigEndian<quint64>(header + 10);
+        position += ENTRY_HEADER_SIZE;
+        if(position + nameLength > length)
+        {
+            break;
+        }
+        QString path = QString::fromUtf8((const char *) content + position, nameLength);
+        position += nameLength;
+        if(size == MISSING_ENTRY)
+        {
+            continue;
+        }
+        if(size > (quint64) (length - position))
+        {
+            qDebug() << "Error - ZSFilePack::unpack() failed: Entry" << path << "is truncated";
+            break;
+        }
+
+        const char *data = (const char *) content + position;
+        position += size;
+        if(!pack.entries.contains(path))
+        {
+            continue;
+        }
+        const ZSPackEntry &entry = pack.entries.value(path);
+        if(entry.checksum != 0 && checksum != entry.checksum)
+        {
+            // Changed on the sender since the update, the next update brings it again
+            qDebug() << "Error - ZSFilePack::unpack() failed for" << path << ": Content changed since the update";
+            continue;
+        }
+        // The staging area verifies the content against the checksum of the entry
+        stagingArea->expectFile(path, size, checksum);
+        stagingArea->writeChunk(path, 0, data, size);
+    }
+    ZSDatabase::getInstance()->commitTransaction();
+}
+
+
+bool ZSFilePack::isExpected(QString packPath)
+{
+    QMutexLocker locker(&mutex);
+    return received.contains(packPath);
+}
+
+
+void ZSFilePack::abort(QString packPath)
+{
+    QMutexLocker locker(&mutex);
+    received.remove(packPath);
+}
@@ -0,0 +1,148 @@
+/* =========================================================================
+   ZSFilePack - Transfers many small files as one unit
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSFILEPACK_H
+#define ZSFILEPACK_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QCache>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QtDebug>
+#include "zssettings.h"
+#include "zsdatabase.h"
+#include "zsstagingarea.h"
+#include "zssha3.h"
+
+
+//!  Announced file that is received as entry of a pack
+struct ZSPackEntry
+{
+    QString path;
+    qint64 size;
+    quint64 checksum;
+};
+
+
+//!  Class that transfers many small files as one unit
+/*!
+  Every file requested from a peer costs a request, chunk round trips and a
+  database update. Small files are therefore requested together under the path of
+  a pack, which lists their paths below .zerosync/packs/. The sender answers the
+  chunks of that path from a stream of all listed files, each with its path, size
+  and checksum; the receiver collects the stream and moves every file into place
+  through the staging area, with the database updates of all of them in one
+  transaction. Hidden paths are never synchronized, so a pack path can not clash
+  with a file. Packs are only requested when enabled in the settings, peers
+  without support would answer them as missing files.
+*/
+class ZSFilePack : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint64 MAXIMUM_ENTRY_SIZE = 64 * 1024;
+    static const qint64 MAXIMUM_PACK_SIZE = 1024 * 1024;
+    static const int MAXIMUM_ENTRIES = 512;
+    static const int MINIMUM_ENTRIES = 8;
+    static const int HEADER_SIZE = 16;
+    static const int ENTRY_HEADER_SIZE = 18;
+
+    //!  Constructor
+    /*!
+      Received entries are committed through the staging area.
+    */
+    explicit ZSFilePack(ZSStagingArea *stagingArea, QObject *parent = 0);
+
+    //!  IsPackPath-Method
+    /*!
+      Returns true if the path names a pack instead of a file.
+    */
+    static bool isPackPath(QString path);
+
+    //!  PackPath-Method
+    /*!
+      Returns the path a pack of the files is requested under.
+    */
+    static QString packPath(QStringList paths);
+
+    //!  EntrySize-Method
+    /*!
+      Returns the bytes a file of the path and size takes in a pack.
+    */
+    static qint64 entrySize(QString path, qint64 size);
+
+    //!  Read-Method
+    /*!
+      Reads up to length bytes at offset of the pack the path names, built from the
+      current content of its files. Returns false if nothing is left to read.
+    */
+    bool read(QString packPath, qint64 offset, qint64 length, QByteArray &data);
+
+    //!  ExpectPack-Method
+    /*!
+      Announces a requested pack with the entries from the updates of its files.
+    */
+    void expectPack(QString packPath, QList<ZSPackEntry> entries);
+
+    //!  WriteChunk-Method
+    /*!
+      Places the chunk in the pack. Returns true if this completed the pack and its
+      files were committed.
+    */
+    bool writeChunk(QString packPath, qint64 offset, const char *data, qint64 length);
+
+    bool isExpected(QString packPath);
+    void abort(QString packPath);
+
+private:
+    struct ReceivedPack
+    {
+        QHash<QString, ZSPackEntry> entries;
+        QByteArray content;
+        QMap<qint64, qint64> ranges;
+        qint64 total;
+    };
+
+    ZSStagingArea *stagingArea;
+    QMutex mutex;
+    QHash<QString, ReceivedPack> received;
+
+    //!  Packs built for the peers, weighted in KiB
+    QCache<QString, QByteArray> built;
+
+    QByteArray build(QString packPath);
+    void unpack(ReceivedPack &pack);
+};
+
+#endif // ZSFILEPACK_H
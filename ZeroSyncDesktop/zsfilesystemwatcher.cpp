@@ -28,145 +28,453 @@
 
 ZSFileSystemWatcher::ZSFileSystemWatcher(QObject *parent) :
     QObject(parent),
-    pathToZeroSyncDirectory()
+    pathToZeroSyncDirectory(),
+    scanGeneration(0),
+    overflowTime(0),
+    peakRescanBacklog(0),
+    lastRecoveryTime(0)
 {
     fileSystemWatcher = new QFileSystemWatcher();
+#ifdef Q_OS_LINUX
+    inotify = new ZSInotify(this);
+#endif
+    eventCoalescer = new ZSEventCoalescer(this, ZSSettings::getInstance()->getCoalesceWindow());
+    coalesceTimer = new QTimer(this);
+    coalesceTimer->setSingleShot(true);
+    rescanTimer = new QTimer(this);
+    rescanTimer->setSingleShot(true);
     establishConnections();
 }
 
 
+ZSFileSystemWatcher::~ZSFileSystemWatcher()
+{
+#ifdef Q_OS_LINUX
+    inotify->requestInterruption();
+    inotify->wait();
+#endif
+    delete fileSystemWatcher;
+}
+
+
 void ZSFileSystemWatcher::establishConnections()
 {
     connect(fileSystemWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(slotDirectoryChanged(QString)));
     connect(fileSystemWatcher, SIGNAL(fileChanged(QString)), this, SLOT(slotFileChanged(QString)));
+    connect(coalesceTimer, SIGNAL(timeout()), this, SLOT(slotProcessSettledChanges()));
+    connect(rescanTimer, SIGNAL(timeout()), this, SLOT(slotProcessRescanQueue()));
+    connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), this, SLOT(slotAboutToQuit()));
+#ifdef Q_OS_LINUX
+    connect(inotify, SIGNAL(signalRescanRequested(QString,bool)), this, SLOT(slotRescanRequested(QString,bool)));
+    connect(inotify, SIGNAL(signalQueueOverflow()), this, SLOT(slotQueueOverflow()));
+    connect(inotify, SIGNAL(signalFileChanged(QString)), this, SIGNAL(signalFileChangeRecognized(QString)));
+    connect(inotify, SIGNAL(signalFileChanged(QString)), this, SIGNAL(signalChangesSettled()));
+#endif
 }
 
 
 void ZSFileSystemWatcher::setZeroSyncDirectory(QString pathToDirectory)
 {
     pathToZeroSyncDirectory = pathToDirectory;
-    setFilesToWatch(pathToZeroSyncDirectory);
+    // The directory state of the last run is only trustworthy after a clean shutdown,
+    // the marker stays cleared while running so a crash leads to a full scan
+    bool warmStart = ZSDatabase::getInstance()->isCleanShutdown();
+    qint64 fullScanAge = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() - ZSDatabase::getInstance()->getLastFullScanTime();
+    if(warmStart && fullScanAge > FULL_SCAN_INTERVAL)
+    {
+        warmStart = false;
+    }
+    ZSDatabase::getInstance()->setCleanShutdown(false);
+    setFilesToWatch(pathToZeroSyncDirectory, warmStart);
+#ifdef Q_OS_LINUX
+    inotify->start();
+#endif
 }
 
 void ZSFileSystemWatcher::changeZeroSyncDirectory(QString pathToDirectory)
 {
     pathToZeroSyncDirectory = pathToDirectory;
+#ifdef Q_OS_LINUX
+    inotify->requestInterruption();
+    inotify->wait();
+#endif
     fileSystemWatcher->removePaths(fileSystemWatcher->files());
     fileSystemWatcher->removePaths(fileSystemWatcher->directories());
+    rescanQueue.clear();
+    recursiveRescans.clear();
     ZSDatabase::getInstance()->deleteAllRowsFromFilesTable();
+    ZSDatabase::getInstance()->resetScanState();
     ZSDatabase::getInstance()->setZeroSyncFolderChangedFlagToFileIndexTable();
     setFilesToWatch(pathToZeroSyncDirectory);
+#ifdef Q_OS_LINUX
+    inotify->start();
+#endif
+}
+
+
+int ZSFileSystemWatcher::getRescanBacklog()
+{
+    return rescanQueue.size();
 }
 
 
-void ZSFileSystemWatcher::setFilesToWatch(QString path)
+qint64 ZSFileSystemWatcher::getLastRecoveryTime()
 {
+    return lastRecoveryTime;
+}
+
+
+void ZSFileSystemWatcher::setFilesToWatch(QString path, bool warmStart)
+{
+#ifndef Q_OS_LINUX
     fileSystemWatcher->addPath(path);
-    QDirIterator directoryIterator(path,  QDir::Files| QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
-    while(directoryIterator.hasNext())
+    // Every file needs its own watch here, so the whole tree has to be walked anyway
+    warmStart = false;
+#endif
+    QHash<QByteArray, ZSKnownDirectory> knownDirectories;
+    if(warmStart)
+    {
+        knownDirectories = loadKnownDirectories(path);
+        warmStart = !knownDirectories.isEmpty();
+    }
+
+    qint64 scanStartTime = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch();
+    scanGeneration = ZSDatabase::getInstance()->nextScanGeneration();
+    ZSDatabase::getInstance()->beginTransaction();
+    // The modification time is taken before reading, so a change while reading is seen next time
+    ZSDatabase::getInstance()->setDirectoryScanned(QString(), QFileInfo(path).lastModified().toUTC().toMSecsSinceEpoch(), scanGeneration);
+    QStringList readDirectories;
+    readDirectories.append(QString());
+
+    ZSDirectoryWalker directoryWalker;
+    directoryWalker.setKnownDirectories(knownDirectories);
+    directoryWalker.start(path, true);
+    QVector<ZSDirectoryEntry> entries;
+    while(directoryWalker.nextBatch(entries))
     {
-        directoryIterator.next();
-        fileSystemWatcher->addPath(directoryIterator.filePath());
-        if(directoryIterator.fileInfo().isFile())
+        foreach(const ZSDirectoryEntry &entry, entries)
         {
-            ZSFileMetaData fileMetaData(this, directoryIterator.filePath(), pathToZeroSyncDirectory);
-            if(!ZSDatabase::getInstance()->existsFileEntry(fileMetaData.getFilePath()))
+#ifndef Q_OS_LINUX
+            fileSystemWatcher->addPath(entry.path);
+#endif
+            ZSDatabase::getInstance()->yieldTransaction();
+            if(!entry.isDir)
+            {
+                scanFile(entry);
+            }
+            else if(entry.unchanged)
             {
-                if(fileMetaData.getFileSize() > 0)
+                ZSDatabase::getInstance()->markDirectoryVisited(entry.path.mid(path.length() + 1), scanGeneration);
+            }
+            else
+            {
+                ZSDatabase::getInstance()->setDirectoryScanned(entry.path.mid(path.length() + 1), entry.lastModified, scanGeneration);
+                readDirectories.append(entry.path.mid(path.length() + 1));
+            }
+        }
+    }
+
+    // A directory that could not be read is no proof that its files are gone
+    foreach(QString failedDirectory, directoryWalker.getFailedDirectories())
+    {
+        qDebug() << "Error - ZSFileSystemWatcher::setFilesToWatch() failed to read" << failedDirectory;
+        ZSDatabase::getInstance()->markDirectoryUnread(failedDirectory.mid(path.length() + 1), scanGeneration);
+    }
+
+    if(warmStart)
+    {
+        // Files of skipped directories were not visited, only the read ones can be swept
+        foreach(QString directory, readDirectories)
+        {
+            ZSDatabase::getInstance()->markUnvisitedFilesDeleted(scanGeneration, directory, false);
+        }
+    }
+    else
+    {
+        ZSDatabase::getInstance()->markUnvisitedFilesDeleted(scanGeneration, QString(), true);
+    }
+    // Known directories that were not found vanished with everything below them
+    foreach(QString directory, ZSDatabase::getInstance()->removeUnvisitedDirectories(scanGeneration))
+    {
+        ZSDatabase::getInstance()->markUnvisitedFilesDeleted(scanGeneration, directory, true);
+    }
+    ZSDatabase::getInstance()->removeStaleContentData();
+    if(!warmStart)
+    {
+        ZSDatabase::getInstance()->setLastFullScanTime(scanStartTime);
+    }
+    ZSDatabase::getInstance()->commitTransaction();
+
+    if(warmStart)
+    {
+        qDebug() << "Information - ZSFileSystemWatcher::setFilesToWatch(): Warm start read" << readDirectories.size() << "of" << knownDirectories.size() << "known directories";
+    }
+    else
+    {
+        qDebug() << "Information - ZSFileSystemWatcher::setFilesToWatch(): Full scan read" << readDirectories.size() << "directories";
+    }
+}
+
+
+QHash<QByteArray, ZSKnownDirectory> ZSFileSystemWatcher::loadKnownDirectories(QString path)
+{
+    QHash<QByteArray, ZSKnownDirectory> knownDirectories;
+    QSqlQuery query = ZSDatabase::getInstance()->fetchAllDirectories();
+    while(query.next())
+    {
+        QString directory = query.value(0).toString();
+        QByteArray absolutePath = (directory.isEmpty() ? path : path + "/" + directory).toLocal8Bit();
+        ZSKnownDirectory &knownDirectory = knownDirectories[absolutePath];
+        knownDirectory.lastModified = query.value(1).toLongLong();
+        knownDirectory.scanned = query.value(2).toLongLong();
+
+        // Registers the directory at its parent, so it is found if the parent is skipped
+        if(!directory.isEmpty())
+        {
+            int separator = absolutePath.lastIndexOf('/');
+            knownDirectories[absolutePath.left(separator)].subdirectories.append(absolutePath.mid(separator + 1));
+        }
+    }
+    return knownDirectories;
+}
+
+
+void ZSFileSystemWatcher::rescanDirectory(QString pathToDirectory, bool recursive)
+{
+    QString directory = QFileInfo(pathToDirectory).absoluteFilePath().remove(0, pathToZeroSyncDirectory.length() + 1);
+    scanGeneration = ZSDatabase::getInstance()->nextScanGeneration();
+    ZSDatabase::getInstance()->beginTransaction();
+    if(QFileInfo(pathToDirectory).isDir())
+    {
+#ifdef Q_OS_LINUX
+        // The modification time is taken before reading, so a change while reading is seen next time
+        QHash<QString, qint64> rescannedDirectories;
+        rescannedDirectories.insert(pathToDirectory, QFileInfo(pathToDirectory).lastModified().toMSecsSinceEpoch());
+#endif
+        // A single directory is not worth spinning up more than one worker
+        ZSDirectoryWalker directoryWalker(0, recursive ? QThread::idealThreadCount() : 1);
+        directoryWalker.start(pathToDirectory, recursive);
+        QVector<ZSDirectoryEntry> entries;
+        while(directoryWalker.nextBatch(entries))
+        {
+            foreach(const ZSDirectoryEntry &entry, entries)
+            {
+                ZSDatabase::getInstance()->yieldTransaction();
+                if(!entry.isDir)
                 {
-                    if(ZSDatabase::getInstance()->existsFileHash(fileMetaData.getHash()))
+                    scanFile(entry);
+                }
+#ifdef Q_OS_LINUX
+                else if(recursive)
+                {
+                    rescannedDirectories.insert(entry.path, entry.lastModified);
+                }
+#endif
+            }
+        }
+        foreach(QString failedDirectory, directoryWalker.getFailedDirectories())
+        {
+            qDebug() << "Error - ZSFileSystemWatcher::rescanDirectory() failed to read" << failedDirectory;
+            ZSDatabase::getInstance()->markDirectoryUnread(QFileInfo(failedDirectory).absoluteFilePath().remove(0, pathToZeroSyncDirectory.length() + 1), scanGeneration);
+#ifdef Q_OS_LINUX
+            rescannedDirectories.remove(failedDirectory);
+#endif
+        }
+#ifdef Q_OS_LINUX
+        // The watches compare against these times after a queue overflow
+        QHashIterator<QString, qint64> iterator(rescannedDirectories);
+        while(iterator.hasNext())
+        {
+            iterator.next();
+            inotify->directoryRescanned(iterator.key(), iterator.value());
+        }
+#endif
+    }
+    // A vanished directory leaves only deleted entries behind
+    ZSDatabase::getInstance()->markUnvisitedFilesDeleted(scanGeneration, directory, recursive);
+    ZSDatabase::getInstance()->commitTransaction();
+}
+
+
+void ZSFileSystemWatcher::scanFile(const ZSDirectoryEntry &entry)
+{
+    ZSFileMetaData fileMetaData(this, entry.path, pathToZeroSyncDirectory, entry.lastModified, entry.size);
+    if(!ZSDatabase::getInstance()->markFileVisited(fileMetaData.getFilePath(), scanGeneration))
+    {
+        if(fileMetaData.getFileSize() > 0)
+        {
+            if(ZSDatabase::getInstance()->existsFileHash(fileMetaData.getHash()))
+            {
+                if(!fileMetaData.existsFile(pathToZeroSyncDirectory + "/" + ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash())))
+                {
+                    if(fileMetaData.getLastModified() == ZSDatabase::getInstance()->getTimestampForFile(ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash())))
                     {
-                        if(!fileMetaData.existsFile(pathToZeroSyncDirectory + "/" + ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash())))
-                        {
-                            if(fileMetaData.getLastModified() == ZSDatabase::getInstance()->getTimestampForFile(ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash())))
-                            {
-                                QString filePathFromHash = ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash());
-                                if (!ZSDatabase::getInstance()->isFileChangedSelf(filePathFromHash)) {
-                                    ZSDatabase::getInstance()->setFileChanged(filePathFromHash, 1);
-                                    ZSDatabase::getInstance()->setFileUpdated(filePathFromHash, 0);
-                                    ZSDatabase::getInstance()->setFileRenamed(filePathFromHash, 1);
-                                    ZSDatabase::getInstance()->setFileChangedSelf(filePathFromHash, 0);
-                                    ZSDatabase::getInstance()->setFileHashToZero(filePathFromHash);
-                                    ZSDatabase::getInstance()->setNewPath(filePathFromHash, fileMetaData.getFilePath());
-                                    addFileToDatabase(directoryIterator.filePath());
-                                    continue;
-                                }
-                            }
-                            else
-                            {
-                                addFileToDatabase(directoryIterator.filePath());
-                                continue;
-                            }
-                        }
-                        else
-                        {
-                            addFileToDatabase(directoryIterator.filePath());
-                            continue;
+                        QString filePathFromHash = ZSDatabase::getInstance()->getFilePathForHash(fileMetaData.getHash());
+                        if (!ZSDatabase::getInstance()->isFileChangedSelf(filePathFromHash)) {
+                            ZSDatabase::getInstance()->setFileChanged(filePathFromHash, 1);
+                            ZSDatabase::getInstance()->setFileUpdated(filePathFromHash, 0);
+                            ZSDatabase::getInstance()->setFileRenamed(filePathFromHash, 1);
+                            ZSDatabase::getInstance()->setFileChangedSelf(filePathFromHash, 0);
+                            ZSDatabase::getInstance()->setFileHashToZero(filePathFromHash);
+                            ZSDatabase::getInstance()->setNewPath(filePathFromHash, fileMetaData.getFilePath());
+                            addFileToDatabase(fileMetaData);
+                            return;
                         }
                     }
                     else
                     {
-                        addFileToDatabase(directoryIterator.filePath());
-                        continue;
+                        addFileToDatabase(fileMetaData);
+                        return;
                     }
                 }
+                else
+                {
+                    addFileToDatabase(fileMetaData);
+                    return;
+                }
             }
             else
             {
-                if(fileMetaData.getLastModified() != ZSDatabase::getInstance()->getTimestampForFile(fileMetaData.getFilePath()) &&
-                        !ZSDatabase::getInstance()->isFileChangedSelf(fileMetaData.getFilePath()))
-                {
-                    ZSDatabase::getInstance()->setFileChanged(fileMetaData.getFilePath(), 1);
-                    ZSDatabase::getInstance()->setFileUpdated(fileMetaData.getFilePath(), 1);
-                    ZSDatabase::getInstance()->setFileDeleted(fileMetaData.getFilePath(), 0);
-                    ZSDatabase::getInstance()->setFileChangedSelf(fileMetaData.getFilePath(), 0);
-                    ZSDatabase::getInstance()->setFileMetaData(fileMetaData.getFilePath(), fileMetaData.getLastModified(), fileMetaData.getHash(), fileMetaData.getFileSize());
-                }
+                addFileToDatabase(fileMetaData);
+                return;
             }
         }
     }
-    QSqlQuery query = ZSDatabase::getInstance()->fetchAllEntriesInFilesTable();
-
-    query.last();
-    query.first();
-    query.previous();
-    while(query.next())
+    else
     {
-        ZSFileMetaData fileMetaData(this, pathToZeroSyncDirectory + "/" + query.value(0).toString(), pathToZeroSyncDirectory);
-        if(!fileMetaData.existsFile(pathToZeroSyncDirectory + "/" + query.value(0).toString()) &&
-           !ZSDatabase::getInstance()->isFileRenamed(query.value(0).toString()) &&
-           !ZSDatabase::getInstance()->isFileDeleted(query.value(0).toString()) &&
-           !ZSDatabase::getInstance()->isFileChangedSelf(query.value(0).toString()))
+        if(fileMetaData.getLastModified() != ZSDatabase::getInstance()->getTimestampForFile(fileMetaData.getFilePath()) &&
+                !ZSDatabase::getInstance()->isFileChangedSelf(fileMetaData.getFilePath()))
         {
+            ZSDatabase::getInstance()->setFileAppended(fileMetaData.getFilePath(), fileMetaData.isAppend());
             ZSDatabase::getInstance()->setFileChanged(fileMetaData.getFilePath(), 1);
-            ZSDatabase::getInstance()->setFileUpdated(fileMetaData.getFilePath(), 0);
-            ZSDatabase::getInstance()->setFileDeleted(fileMetaData.getFilePath(), 1);
+            ZSDatabase::getInstance()->setFileUpdated(fileMetaData.getFilePath(), 1);
+            ZSDatabase::getInstance()->setFileDeleted(fileMetaData.getFilePath(), 0);
             ZSDatabase::getInstance()->setFileChangedSelf(fileMetaData.getFilePath(), 0);
-            ZSDatabase::getInstance()->setFileMetaData(fileMetaData.getFilePath(), QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch() , fileMetaData.getHash(), fileMetaData.getFileSize());
+            ZSDatabase::getInstance()->setFileMetaData(fileMetaData.getFilePath(), fileMetaData.getLastModified(), fileMetaData.getHash(), fileMetaData.getFileSize());
+            ZSDatabase::getInstance()->setFileChunks(fileMetaData.getFilePath(), fileMetaData.getChunks());
         }
     }
 }
 
 
-void ZSFileSystemWatcher::addFileToDatabase(QString pathToFile)
+void ZSFileSystemWatcher::addFileToDatabase(ZSFileMetaData &fileMetaData)
 {
-    ZSFileMetaData fileMetaData(this, pathToFile, pathToZeroSyncDirectory);
-    ZSDatabase::getInstance()->insertNewFile(fileMetaData.getFilePath(), fileMetaData.getLastModified(), fileMetaData.getHash(), fileMetaData.getFileSize());
+    ZSDatabase::getInstance()->insertNewFile(fileMetaData.getFilePath(), fileMetaData.getLastModified(), fileMetaData.getHash(), fileMetaData.getFileSize(), scanGeneration, fileMetaData.isChangedSelf() ? 1 : 0);
+    ZSDatabase::getInstance()->setFileChunks(fileMetaData.getFilePath(), fileMetaData.getChunks());
 }
 
 
 void ZSFileSystemWatcher::slotDirectoryChanged(QString pathToDirectory)
 {
-    emit signalDirectoryChangeRecognized(pathToDirectory);
-    setFilesToWatch(pathToZeroSyncDirectory);
-    qDebug() << "Information - ZSFileSystemWatcher::slotDirectoryChanged(): " << pathToDirectory;
+    eventCoalescer->addEvent(pathToDirectory, QDateTime::currentMSecsSinceEpoch());
+    scheduleSettledChanges();
 }
 
 
 void ZSFileSystemWatcher::slotFileChanged(QString pathToFile)
 {
-    ZSFileMetaData fileMetaData(this, pathToFile, pathToZeroSyncDirectory);
-    emit signalFileChangeRecognized(fileMetaData.getFilePath());
-    setFilesToWatch(pathToZeroSyncDirectory);
-    qDebug() << "Information - ZSFileSystemWatcher::slotFileChanged(): " << fileMetaData.getFilePath();
+    eventCoalescer->addEvent(pathToFile, QDateTime::currentMSecsSinceEpoch());
+    scheduleSettledChanges();
+}
+
+
+void ZSFileSystemWatcher::scheduleSettledChanges()
+{
+    int timeout = eventCoalescer->msecsUntilNextSettle(QDateTime::currentMSecsSinceEpoch());
+    if(timeout >= 0)
+    {
+        coalesceTimer->start(timeout);
+    }
+}
+
+
+void ZSFileSystemWatcher::slotProcessSettledChanges()
+{
+    QStringList settledPaths = eventCoalescer->takeSettledPaths(QDateTime::currentMSecsSinceEpoch());
+    if(!settledPaths.isEmpty())
+    {
+        foreach(QString path, settledPaths)
+        {
+            if(QFileInfo(path).isDir())
+            {
+                emit signalDirectoryChangeRecognized(path);
+                qDebug() << "Information - ZSFileSystemWatcher::slotDirectoryChanged(): " << path;
+            }
+            else
+            {
+                QString filePath = QFileInfo(path).absoluteFilePath().remove(0, pathToZeroSyncDirectory.length() + 1);
+                emit signalFileChangeRecognized(filePath);
+                qDebug() << "Information - ZSFileSystemWatcher::slotFileChanged(): " << filePath;
+            }
+        }
+        // One rescan for everything that settled in this round
+        setFilesToWatch(pathToZeroSyncDirectory);
+        emit signalChangesSettled();
+    }
+    scheduleSettledChanges();
+}
+
+
+void ZSFileSystemWatcher::slotRescanRequested(QString pathToDirectory, bool recursive)
+{
+    if(!rescanQueue.contains(pathToDirectory))
+    {
+        rescanQueue.append(pathToDirectory);
+    }
+    if(recursive)
+    {
+        recursiveRescans.insert(pathToDirectory);
+    }
+    peakRescanBacklog = qMax(peakRescanBacklog, rescanQueue.size());
+    if(!rescanTimer->isActive())
+    {
+        rescanTimer->start(0);
+    }
+}
+
+
+void ZSFileSystemWatcher::slotQueueOverflow()
+{
+    if(overflowTime == 0)
+    {
+        overflowTime = QDateTime::currentMSecsSinceEpoch();
+    }
+}
+
+
+void ZSFileSystemWatcher::slotProcessRescanQueue()
+{
+    if(rescanQueue.isEmpty())
+    {
+        return;
+    }
+
+    // One directory per event loop iteration keeps the application responsive
+    QString pathToDirectory = rescanQueue.takeFirst();
+    rescanDirectory(pathToDirectory, recursiveRescans.remove(pathToDirectory));
+
+    if(!rescanQueue.isEmpty())
+    {
+        rescanTimer->start(0);
+        return;
+    }
+    emit signalChangesSettled();
+    if(overflowTime > 0)
+    {
+        lastRecoveryTime = QDateTime::currentMSecsSinceEpoch() - overflowTime;
+        qDebug() << "Information - ZSFileSystemWatcher::slotProcessRescanQueue(): Recovered from queue overflow in" << lastRecoveryTime << "ms, peak rescan backlog" << peakRescanBacklog;
+        overflowTime = 0;
+        peakRescanBacklog = 0;
+    }
+}
+
+
+void ZSFileSystemWatcher::slotAboutToQuit()
+{
+#ifdef Q_OS_LINUX
+    // Pending events are flushed to the database when the thread stops
+    inotify->requestInterruption();
+    inotify->wait();
+#endif
+    ZSDatabase::getInstance()->setCleanShutdown(true);
 }
@@ -34,9 +34,19 @@
 #include <QCryptographicHash>
 #include <QDateTime>
 #include <QStandardPaths>
+#include <QTimer>
+#include <QSet>
+#include <QHash>
+#include <QCoreApplication>
 #include "zsdatabase.h"
 #include "zsfilemetadata.h"
 #include "zsindex.h"
+#include "zseventcoalescer.h"
+#include "zsdirectorywalker.h"
+#include "zssettings.h"
+#ifdef Q_OS_LINUX
+#include "zsinotify.h"
+#endif
 
 
 //!  Class that provides the ZeroSync filesystem watcher
@@ -54,23 +64,100 @@ public:
       The default constructor.
     */
     explicit ZSFileSystemWatcher(QObject *parent = 0);
+
+    //!  Destructor
+    /*!
+      Stops the watcher thread before it is destroyed.
+    */
+    ~ZSFileSystemWatcher();
     void setZeroSyncDirectory(QString);
     void changeZeroSyncDirectory(QString);
 
+    //!  GetRescanBacklog-Method
+    /*!
+      Returns the number of directories that are still waiting to be rescanned.
+    */
+    int getRescanBacklog();
+
+    //!  GetLastRecoveryTime-Method
+    /*!
+      Returns the milliseconds it took to work off the rescans after the last queue overflow.
+    */
+    qint64 getLastRecoveryTime();
+
 private:
     QFileSystemWatcher *fileSystemWatcher;
     QString pathToZeroSyncDirectory;
+
+#ifdef Q_OS_LINUX
+    //!  Recursive inotify watcher
+    /*!
+      On Linux the directories are watched with inotify instead of the QFileSystemWatcher.
+    */
+    ZSInotify *inotify;
+#endif
+
+    //!  Directories waiting for a rescan
+    /*!
+      Directories whose events may have been lost are rescanned one at a time, the
+      ones in recursiveRescans including all of their subdirectories.
+    */
+    QStringList rescanQueue;
+    QSet<QString> recursiveRescans;
+    QTimer *rescanTimer;
+
+    //!  Generation of the running scan
+    /*!
+      Every entry visited by a scan is stamped with its generation, entries of the
+      scanned area with an older generation were not found and are deleted.
+    */
+    int scanGeneration;
+
+    //!  Maximum age of the last full scan for a warm start
+    /*!
+      A warm start skips directories whose modification time did not change, which
+      misses files edited in place while ZeroSync was not running. Once the last
+      full scan is older than this many milliseconds every directory is read again.
+    */
+    static const qint64 FULL_SCAN_INTERVAL = 24 * 60 * 60 * 1000;
+
+    qint64 overflowTime;
+    int peakRescanBacklog;
+    qint64 lastRecoveryTime;
+
+    //!  Coalescer for the change notifications of the QFileSystemWatcher
+    /*!
+      Bursts of notifications are merged per path, so a burst results in one rescan.
+    */
+    ZSEventCoalescer *eventCoalescer;
+    QTimer *coalesceTimer;
+
     void establishConnections();
-    void setFilesToWatch(QString);
-    void addFileToDatabase(QString);
+    void scheduleSettledChanges();
+    void setFilesToWatch(QString, bool = false);
+    QHash<QByteArray, ZSKnownDirectory> loadKnownDirectories(QString);
+    void rescanDirectory(QString, bool);
+    void scanFile(const ZSDirectoryEntry &);
+    void addFileToDatabase(ZSFileMetaData &);
 
 signals:
     void signalDirectoryChangeRecognized(QString);
     void signalFileChangeRecognized(QString);
 
+    //!  ChangesSettled-Signal
+    /*!
+      Emitted after settled changes or a rescan were written to the database.
+    */
+    void signalChangesSettled();
+
 private slots:
     void slotDirectoryChanged(QString);
     void slotFileChanged(QString);
+    void slotProcessSettledChanges();
+    void slotRescanRequested(QString, bool);
+    void slotQueueOverflow();
+    void slotProcessRescanQueue();
+    void slotAboutToQuit();
 
 };
 
@@ -26,19 +26,62 @@
 #include "zsindex.h"
 
 ZSIndex::ZSIndex(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    firstChange(0)
 {
+    publishTimer = new QTimer(this);
+    publishTimer->setSingleShot(true);
+    connect(publishTimer, SIGNAL(timeout()), this, SLOT(slotUpdateIndex()));
     latestState = ZSDatabase::getInstance()->getLatestState();
     slotUpdateIndex();
 }
 
 
+int ZSIndex::getSafetyNetInterval()
+{
+    int syncInterval = ZSSettings::getInstance()->getSyncInterval();
+    return syncInterval > SAFETY_NET_INTERVAL ? syncInterval : SAFETY_NET_INTERVAL;
+}
+
+
+void ZSIndex::slotChangesSettled()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if(!publishTimer->isActive())
+    {
+        firstChange = now;
+    }
+    // Every change restarts the delay, but not beyond the latency bound of the first one
+    qint64 remaining = firstChange + MAXIMUM_LATENCY - now;
+    publishTimer->start(qBound((qint64) 0, remaining, (qint64) MINIMUM_DELAY));
+}
+
+
 void ZSIndex::slotUpdateIndex()
 {
+    publishTimer->stop();
+    // Changes recorded by other threads meanwhile wait for the commit, the reset below
+    // only clears the entries that were published
+    ZSDatabase::getInstance()->beginTransaction();
     latestState = ZSDatabase::getInstance()->getLatestState();
-    QSqlQuery query = ZSDatabase::getInstance()->fetchAllChangedEntriesInFilesTable();
     bool indexChanged = false;
 
+    // Directory operations go first, files announced with them refer to the new layout
+    qint64 lastDirectoryChange = 0;
+    QSqlQuery directoryChanges = ZSDatabase::getInstance()->fetchDirectoryChanges();
+    while(directoryChanges.next())
+    {
+        ZSDatabase::getInstance()->insertNewIndexEntry(latestState + 1, directoryChanges.value(0).toString(), directoryChanges.value(2).toString(), directoryChanges.value(3).toLongLong(), 0, directoryChanges.value(1).toString(), QString(""), 0);
+        lastDirectoryChange = directoryChanges.value(4).toLongLong();
+        indexChanged = true;
+    }
+    if(lastDirectoryChange > 0)
+    {
+        ZSDatabase::getInstance()->removeDirectoryChanges(lastDirectoryChange);
+    }
+
+    QSqlQuery query = ZSDatabase::getInstance()->fetchAllChangedEntriesInFilesTable();
+
     query.last();
     query.first();
     query.previous();
@@ -49,11 +92,13 @@ void ZSIndex::slotUpdateIndex()
         int renamed = query.value(7).toInt();
         int deleted = query.value(9).toInt();
         int changed_self = query.value(10).toInt();
+        int appended = query.value(12).toInt();
         indexChanged = true;
 
         if(updated == 1)
         {
-            ZSDatabase::getInstance()->insertNewIndexEntry(latestState + 1, query.value(0).toString(), "UPD", query.value(1).toLongLong(), query.value(3).toInt(), QString(), query.value(2).toString(), changed_self);
+            // Appends are kept apart, so peers holding the old content can fetch just the tail
+            ZSDatabase::getInstance()->insertNewIndexEntry(latestState + 1, query.value(0).toString(), appended == 1 ? "APP" : "UPD", query.value(1).toLongLong(), query.value(3).toInt(), QString(), query.value(2).toString(), changed_self);
         }
         if(deleted == 1)
         {
@@ -65,8 +110,13 @@ void ZSIndex::slotUpdateIndex()
         }
 
     }
+    directoryChanges.finish();
+    query.finish();
     if (indexChanged) {
         ZSDatabase::getInstance()->resetFileMetaData();
+    }
+    ZSDatabase::getInstance()->commitTransaction();
+    if (indexChanged) {
         qDebug() << "Information - ZSIndex::slotUpdateIndex() succeeded: Fileindex updated";
         emit signalIndexUpdated(latestState + 1);
     }
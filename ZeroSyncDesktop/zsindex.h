@@ -30,14 +30,22 @@
 #include <QtDebug>
 #include <QSqlQuery>
 #include <QSqlDatabase>
+#include <QTimer>
+#include <QDateTime>
 #include "zsdatabase.h"
 #include "zsfilemetadata.h"
+#include "zssettings.h"
 
 
 //!  Class that provides the ZeroSync index functionality
 /*!
   This class is used to update the ZeroSync index within the local
   SQLite database.
+
+  The index is published once the watcher reports that changes settled. Further
+  changes within the minimum delay join the same publication, but a steady stream
+  of changes is published at least every maximum latency. The timer of the sync
+  interval only remains as a safety net for changes no signal reported.
 */
 class ZSIndex : public QObject
 {
@@ -50,6 +58,22 @@ public:
     */
     explicit ZSIndex(QObject *parent = 0);
 
+    //!  Milliseconds a publication waits for further changes
+    static const int MINIMUM_DELAY = 200;
+
+    //!  Milliseconds a change waits for its publication at most
+    static const int MAXIMUM_LATENCY = 1000;
+
+    //!  Shortest interval of the safety net timer in milliseconds
+    static const int SAFETY_NET_INTERVAL = 60000;
+
+    //!  GetSafetyNetInterval-Method
+    /*!
+      Returns the interval of the safety net timer, the sync interval but not shorter
+      than SAFETY_NET_INTERVAL.
+    */
+    static int getSafetyNetInterval();
+
     //!  Deconstructor
     /*!
       The default deconstructor.
@@ -63,6 +87,9 @@ private:
     */
     int latestState;
 
+    QTimer *publishTimer;
+    qint64 firstChange;
+
 signals:
     //!  IndexUpdated-Signal
     /*!
@@ -77,6 +104,12 @@ public slots:
     */
     void slotUpdateIndex();
 
+    //!  ChangesSettled-Slot
+    /*!
+      Slot that schedules the publication of the index after changes were recorded.
+    */
+    void slotChangesSettled();
+
 };
 
 #endif // ZSINDEX_H
@@ -24,35 +24,220 @@
 
 #include "zsinotify.h"
 
+#include <limits>
+
+// Time in milliseconds an IN_MOVED_FROM waits for its IN_MOVED_TO partner
+static const int MOVE_PAIRING_WINDOW = 500;
+
+// Directories with events this recent may have lost some to a queue overflow
+static const int OVERFLOW_ACTIVITY_WINDOW = 5000;
+
+// Longest poll() so the thread notices an interruption request
+static const int INTERRUPTION_CHECK_INTERVAL = 1000;
+
+// Only the events that lead to an action, access events would fill the queue
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF | IN_ONLYDIR;
+
+ZSInotify::ZSInotify(QObject *parent) :
+    QThread(parent),
+    coalescer(0),
+    inotify(-1)
+{
+}
+
 void ZSInotify::run() {
 
-    char *syncdir = ZSSettings::getInstance()->getZeroSyncDirectory().toLatin1().data();
+    syncDirectory = ZSSettings::getInstance()->getZeroSyncDirectory();
 
 
     int EVENT_LEN = sizeof( struct inotify_event );
-    int BUF_LEN = 1024 * ( EVENT_LEN + 16 );
-    int inotify, wd;
-    char buf[BUF_LEN];
+    const int BUF_LEN = 64 * 1024;
+    char buf[BUF_LEN] __attribute__ ((aligned(__alignof__(struct inotify_event))));
     ssize_t numRead;
     char *p;
     struct inotify_event *event;
+    struct pollfd pfd;
+
+    coalescer = new ZSEventCoalescer(0, ZSSettings::getInstance()->getCoalesceWindow());
+    ZSFileHasher::setModificationsWatched(true);
 
     // Create inotify instance
     inotify = inotify_init();
 
-    wd = inotify_add_watch( inotify, syncdir, IN_ALL_EVENTS );
+    // Watch the sync directory and every directory below it
+    addWatch(syncDirectory, true);
+
+    pfd.fd = inotify;
+    pfd.events = POLLIN;
 
-    for (;;) {
-        numRead = read(inotify, buf, BUF_LEN);
+    while (!isInterruptionRequested()) {
+        if (poll(&pfd, 1, nextTimeout(QDateTime::currentMSecsSinceEpoch())) > 0) {
+            numRead = read(inotify, buf, BUF_LEN);
+
+            // Process all of the events in buffer returned by read()
+            for (p = buf; p < buf + numRead; ) {
+                event = (struct inotify_event *) p; // retrieve the p'th event
+                handler(event); // handle it
+                p += EVENT_LEN + event->len; // point to next event
+            }
+        }
+        applyRescannedDirectories();
+        expirePendingMoves(QDateTime::currentMSecsSinceEpoch());
+        processSettledFiles(QDateTime::currentMSecsSinceEpoch());
+    }
 
-        // Process all of the events in buffer returned by read()
+    // Records everything still in flight, the next start relies on an up to date database
+    while (poll(&pfd, 1, 0) > 0 && (numRead = read(inotify, buf, BUF_LEN)) > 0) {
         for (p = buf; p < buf + numRead; ) {
-            event = (struct inotify_event *) p; // retrieve the p'th event
-            handler(event); // handle it
-            p += EVENT_LEN + event->len; // point to next event
+            event = (struct inotify_event *) p;
+            handler(event);
+            p += EVENT_LEN + event->len;
         }
     }
+    expirePendingMoves(std::numeric_limits<qint64>::max());
+    processSettledFiles(std::numeric_limits<qint64>::max());
+
+    ZSFileHasher::setModificationsWatched(false);
+    close(inotify);
+    inotify = -1;
+    watchedDirectories.clear();
+    watchDescriptors.clear();
+    pendingMoves.clear();
+    rescannedDirectoriesMutex.lock();
+    rescannedDirectories.clear();
+    rescannedDirectoriesMutex.unlock();
+    delete coalescer;
+    coalescer = 0;
+}
+
+int ZSInotify::nextTimeout(qint64 now)
+{
+    // Wake up early while move halves wait for a partner or files wait to settle
+    int timeout = coalescer->msecsUntilNextSettle(now);
+    if (!pendingMoves.isEmpty() && (timeout < 0 || timeout > MOVE_PAIRING_WINDOW)) {
+        timeout = MOVE_PAIRING_WINDOW;
+    }
+    if (timeout < 0 || timeout > INTERRUPTION_CHECK_INTERVAL) {
+        timeout = INTERRUPTION_CHECK_INTERVAL;
+    }
+    return timeout;
+}
+
+void ZSInotify::processSettledFiles(qint64 now)
+{
+    foreach (QString path, coalescer->takeSettledPaths(now)) {
+        if (QFileInfo(path).isFile()) {
+            fileUpdated(path);
+            emit signalFileChanged(relativePath(path));
+        }
+    }
+}
+
+void ZSInotify::addWatch(QString path, bool recursive)
+{
+    int wd = inotify_add_watch(inotify, path.toLocal8Bit().constData(), WATCH_MASK);
+    if (wd < 0) {
+        qDebug() << "Error - ZSInotify::addWatch() failed for" << path << ": " << strerror(errno);
+        return;
+    }
+
+    WatchedDirectory directory;
+    directory.path = path;
+    directory.mtime = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+    directory.lastEvent = 0;
+    watchedDirectories.insert(wd, directory);
+    watchDescriptors.insert(path, wd);
 
+    if (recursive) {
+        QDirIterator directoryIterator(path, QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (directoryIterator.hasNext()) {
+            addWatch(directoryIterator.next(), false);
+        }
+    }
+}
+
+void ZSInotify::removeWatches(QString path)
+{
+    QMutableHashIterator<int, WatchedDirectory> iterator(watchedDirectories);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.value().path == path || iterator.value().path.startsWith(path + "/")) {
+            inotify_rm_watch(inotify, iterator.key());
+            watchDescriptors.remove(iterator.value().path);
+            iterator.remove();
+        }
+    }
+}
+
+void ZSInotify::renameWatches(QString oldPath, QString newPath)
+{
+    QMutableHashIterator<int, WatchedDirectory> iterator(watchedDirectories);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (iterator.value().path == oldPath || iterator.value().path.startsWith(oldPath + "/")) {
+            watchDescriptors.remove(iterator.value().path);
+            iterator.value().path.replace(0, oldPath.length(), newPath);
+            watchDescriptors.insert(iterator.value().path, iterator.key());
+        }
+    }
+}
+
+void ZSInotify::queueOverflowed()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qDebug() << "Warning - ZSInotify::queueOverflowed(): Kernel event queue overflowed, scheduling rescans";
+    // Modifications may have been missed, no file is resumed until it was hashed completely again
+    ZSFileHasher::setModificationsWatched(true);
+    emit signalQueueOverflow();
+
+    // Lost events can only be in directories that were busy before the overflow
+    // or whose entries changed since their watch was set up or last rescanned
+    QStringList suspects;
+    QMutableHashIterator<int, WatchedDirectory> iterator(watchedDirectories);
+    while (iterator.hasNext()) {
+        iterator.next();
+        qint64 mtime = QFileInfo(iterator.value().path).lastModified().toMSecsSinceEpoch();
+        if (now - iterator.value().lastEvent <= OVERFLOW_ACTIVITY_WINDOW || mtime != iterator.value().mtime) {
+            iterator.value().mtime = mtime;
+            suspects.append(iterator.value().path);
+        }
+    }
+
+    foreach (QString path, suspects) {
+        // Subdirectories created while events were dropped have no watch yet
+        foreach (QString subdirectory, QDir(path).entryList(QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot)) {
+            QString pathToSubdirectory = path + "/" + subdirectory;
+            if (!watchDescriptors.contains(pathToSubdirectory)) {
+                addWatch(pathToSubdirectory, true);
+                emit signalRescanRequested(pathToSubdirectory, true);
+            }
+        }
+        emit signalRescanRequested(path, false);
+    }
+}
+
+void ZSInotify::directoryRescanned(QString path, qint64 mtime)
+{
+    QMutexLocker locker(&rescannedDirectoriesMutex);
+    rescannedDirectories.insert(path, mtime);
+}
+
+void ZSInotify::applyRescannedDirectories()
+{
+    QHash<QString, qint64> rescanned;
+    rescannedDirectoriesMutex.lock();
+    rescanned.swap(rescannedDirectories);
+    rescannedDirectoriesMutex.unlock();
+
+    QHashIterator<QString, qint64> iterator(rescanned);
+    while (iterator.hasNext()) {
+        iterator.next();
+        // The watch may be gone again by the time the rescan finished
+        if (watchDescriptors.contains(iterator.key())) {
+            watchedDirectories[watchDescriptors.value(iterator.key())].mtime = iterator.value();
+        }
+    }
 }
 
 void ZSInotify::handler( struct inotify_event *event ) {
@@ -60,7 +245,32 @@ void ZSInotify::handler( struct inotify_event *event ) {
     char action[100];
     bool isDir = false;
 
-    QString path(event->name);
+    if (event->mask & IN_Q_OVERFLOW) {
+        queueOverflowed();
+        return;
+    }
+
+    if (!watchedDirectories.contains(event->wd)) {
+        // Event of a watch that was already removed
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        watchDescriptors.remove(watchedDirectories.take(event->wd).path);
+        return;
+    }
+
+    // Hidden entries are skipped by the scanner as well
+    if (event->len > 0 && event->name[0] == '.') {
+        return;
+    }
+
+    WatchedDirectory &directory = watchedDirectories[event->wd];
+    directory.lastEvent = QDateTime::currentMSecsSinceEpoch();
+    QString path = directory.path;
+    if (event->len > 0) {
+        path.append("/").append(QString::fromLocal8Bit(event->name));
+    }
 
     // Is it a file or a directory?
     if ( event->mask & IN_ISDIR ) {
@@ -79,27 +289,79 @@ void ZSInotify::handler( struct inotify_event *event ) {
     else if (event->mask & IN_CLOSE_NOWRITE)
         strcpy(action, "closed after being open in read-only"); // NO ACTION
     else if (event->mask & IN_CLOSE_WRITE) {
-        strcpy(action, "closed after being open in read-write"); // ACTION: Prepare UPD update
+        strcpy(action, "closed after being open in read-write"); // ACTION: Prepare UPD update once settled
         if(!isDir) {
-            fileUpdated(path);
+            coalescer->addEvent(path, QDateTime::currentMSecsSinceEpoch());
+        }
+    }
+    else if (event->mask & IN_CREATE) {
+        strcpy(action, "created"); // ACTION: Prepare UPD update once settled / Add watchdir, rescan it
+        if(!isDir) {
+            coalescer->addEvent(path, QDateTime::currentMSecsSinceEpoch());
+        }
+        else {
+            // Entries may have been created before the watch was in place
+            addWatch(path, true);
+            emit signalRescanRequested(path, true);
         }
     }
-    else if (event->mask & IN_CREATE)
-        strcpy(action, "created"); // ACTION: Prepare UPD update / Add watchdir, prepare UPD update
     else if (event->mask & IN_DELETE) {
-        strcpy(action, "deleted"); // ACTION: Prepare DEL update / Remove watchdir, prepare DEL update
+        strcpy(action, "deleted"); // ACTION: Prepare DEL update / watch is removed by IN_IGNORED
         if(!isDir) {
+            coalescer->removePath(path);
             fileDeleted(path);
         }
+        else {
+            directoryDeleted(path);
+        }
     }
     else if (event->mask & IN_DELETE_SELF)
         strcpy(action, "deleted and is the watched directory/file"); // ACTION: STOP programm
-    else if (event->mask & IN_MODIFY)
-        strcpy(action, "modified"); // ACTION: Prepare UPD update
-    else if (event->mask & IN_MOVED_FROM)
-        strcpy(action, "moved from watched directory"); // ACTION: Prepare DEL update / remove watchdir, prepare DEL update
-    else if (event->mask & IN_MOVED_TO)
-        strcpy(action, "moved into watched directory"); // ACTION: Prepare UPD/REN update (cookie) / add watchdir, prepare UPD/REN update
+    else if (event->mask & IN_MODIFY) {
+        strcpy(action, "modified"); // ACTION: Prepare UPD update once settled
+        if(!isDir) {
+            ZSFileHasher::noteModified(path, relativePath(path));
+            coalescer->addEvent(path, QDateTime::currentMSecsSinceEpoch());
+        }
+    }
+    else if (event->mask & IN_MOVED_FROM) {
+        strcpy(action, "moved from watched directory"); // ACTION: Wait for IN_MOVED_TO with same cookie, else prepare DEL update
+        PendingMove move;
+        move.path = path;
+        move.isDir = isDir;
+        move.settling = coalescer->removePath(path);
+        move.time = QDateTime::currentMSecsSinceEpoch();
+        pendingMoves.insert(event->cookie, move);
+    }
+    else if (event->mask & IN_MOVED_TO) {
+        strcpy(action, "moved into watched directory"); // ACTION: Prepare REN update if paired by cookie, else prepare UPD update
+        if (pendingMoves.contains(event->cookie)) {
+            PendingMove move = pendingMoves.take(event->cookie);
+            if(!isDir) {
+                fileRenamed(move.path, path);
+                // Content was still being written before the move, hash it once settled
+                if (move.settling) {
+                    coalescer->addEvent(path, QDateTime::currentMSecsSinceEpoch());
+                }
+            }
+            else {
+                // One directory rename moves the entries of all files below it, announced as one operation
+                ZSDatabase::getInstance()->renameDirectoryEntries(relativePath(move.path), relativePath(path), true);
+                renameWatches(move.path, path);
+                emit signalFileChanged(relativePath(path));
+                // The rescans only pick up what changed while the directory moved
+                emit signalRescanRequested(path, true);
+                emit signalRescanRequested(move.path, true);
+            }
+        }
+        else if(!isDir) {
+            fileMovedIn(path);
+        }
+        else {
+            addWatch(path, true);
+            emit signalRescanRequested(path, true);
+        }
+    }
     else if (event->mask & IN_MOVE_SELF)
         strcpy(action, "moved and is the watched directory/file"); // ACTION: STOP programm
     else if (event->mask & IN_OPEN)
@@ -107,74 +369,121 @@ void ZSInotify::handler( struct inotify_event *event ) {
     else if (event->mask & IN_UNMOUNT)
         strcpy(action, "on a filesystem which has just be unmounted"); // NO ACTION
     else {
-        printf("Unknown event %#x", event->mask);
+        printf("Unknown event %#x\n", event->mask);
         return;
     }
 
     // Print out the info
-    printf("The %s /%s was %s. (%d)\n", fType, event->name, action, event->cookie);
+    printf("The %s %s was %s. (%d)\n", fType, path.toLocal8Bit().constData(), action, event->cookie);
 }
 
-void ZSInotify::fileUpdated(QString path) {
-    int length = ZSSettings::getInstance()->getZeroSyncDirectory().length();
-    QFileInfo file(path);
-    qint64 timestamp = file.lastModified().toUTC().toMSecsSinceEpoch();
-    QString hash = calculateHash(path);
-    qint64 filesize = file.size();
-    path.remove(0, length);
+void ZSInotify::expirePendingMoves(qint64 now)
+{
+    QMutableHashIterator<quint32, PendingMove> iterator(pendingMoves);
+    while (iterator.hasNext()) {
+        iterator.next();
+        // Partner never showed up, the file was moved out of the sync directory
+        if (now - iterator.value().time >= MOVE_PAIRING_WINDOW) {
+            if (!iterator.value().isDir) {
+                fileMovedOut(iterator.value().path, iterator.key());
+            }
+            else {
+                // Everything below the vanished directory is announced with one directory delete
+                directoryDeleted(iterator.value().path);
+                removeWatches(iterator.value().path);
+                emit signalRescanRequested(iterator.value().path, true);
+            }
+            iterator.remove();
+        }
+    }
+}
 
-    ZSDatabase::getInstance()->setFileChanged(path, 1);
-    ZSDatabase::getInstance()->setFileUpdated(path, 1);
-    ZSDatabase::getInstance()->setFileDeleted(path, 0);
-    ZSDatabase::getInstance()->setFileMetaData(path, timestamp, hash, filesize);
+QString ZSInotify::relativePath(QString path)
+{
+    return path.remove(0, syncDirectory.length() + 1);
 }
 
-void ZSInotify::fileMovedIn(QString path, quint32 ref) {
-    int length = ZSSettings::getInstance()->getZeroSyncDirectory().length();
+void ZSInotify::fileUpdated(QString path) {
     QFileInfo file(path);
     qint64 timestamp = file.lastModified().toUTC().toMSecsSinceEpoch();
-    QString hash = calculateHash(path);
     qint64 filesize = file.size();
-    path.remove(0, length);
+    QString absolutePath = path;
+    path = relativePath(path);
+
+    // Files that only grew are hashed from where the last hash ended
+    ZSFileHasher fileHasher;
+    QString hash = fileHasher.hashFile(absolutePath, path);
+    QList<ZSChunk> chunks = fileHasher.getChunks();
 
+    // A file received from a peer is recorded without announcing it back
+    if (!ZSDatabase::getInstance()->existsFileEntry(path)) {
+        ZSDatabase::getInstance()->insertNewFile(path, timestamp, hash, filesize, 0, fileHasher.isChangedSelf() ? 1 : 0);
+        ZSDatabase::getInstance()->setFileChunks(path, chunks);
+        return;
+    }
+    if (fileHasher.isChangedSelf()) {
+        ZSDatabase::getInstance()->setFileChangedSelf(path, 1);
+    }
+    // Stamped before it is revived, a running scan must not sweep it once it is present again
+    ZSDatabase::getInstance()->markFileVisited(path, ZSDatabase::getInstance()->getScanGeneration());
+    ZSDatabase::getInstance()->setFileAppended(path, fileHasher.isAppend());
     ZSDatabase::getInstance()->setFileChanged(path, 1);
     ZSDatabase::getInstance()->setFileUpdated(path, 1);
     ZSDatabase::getInstance()->setFileDeleted(path, 0);
     ZSDatabase::getInstance()->setFileMetaData(path, timestamp, hash, filesize);
+    ZSDatabase::getInstance()->setFileChunks(path, chunks);
+}
 
-    if (ref > 0) {
-        // TODO: change DEL to REN
-    }
+void ZSInotify::fileMovedIn(QString path) {
+    // Unpaired IN_MOVED_TO: the file came from outside, announce it as UPD once settled
+    coalescer->addEvent(path, QDateTime::currentMSecsSinceEpoch());
 }
 
 void ZSInotify::fileMovedOut(QString path, quint32 ref) {
-    int length = ZSSettings::getInstance()->getZeroSyncDirectory().length();
-    path.remove(0, length);
+    path = relativePath(path);
+    ZSFileHasher::forget(path);
 
     ZSDatabase::getInstance()->setFileChanged(path, 1);
     ZSDatabase::getInstance()->setFileUpdated(path, 0);
     ZSDatabase::getInstance()->setFileDeleted(path, 1);
     ZSDatabase::getInstance()->setFileReference(path, ref);
     ZSDatabase::getInstance()->setFileTimestamp(path, QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
+    emit signalFileChanged(path);
+}
+
+void ZSInotify::fileRenamed(QString oldPath, QString newPath) {
+    QString oldRelativePath = relativePath(oldPath);
+    ZSFileHasher::forget(oldRelativePath);
+    ZSFileHasher::forget(relativePath(newPath));
+
+    // Without a known source there is nothing to rename, treat it as new file
+    if (!ZSDatabase::getInstance()->existsFileEntry(oldRelativePath)) {
+        fileMovedIn(newPath);
+        return;
+    }
+    // Content is unchanged by a rename, so carry metadata over without hashing
+    QString newRelativePath = relativePath(newPath);
+    ZSDatabase::getInstance()->renameFileEntry(oldRelativePath, newRelativePath);
+    emit signalFileChanged(oldRelativePath);
+    emit signalFileChanged(newRelativePath);
+}
+
+void ZSInotify::directoryDeleted(QString path) {
+    path = relativePath(path);
+
+    // Files deleted one by one before their directory are folded into the directory delete
+    if (ZSDatabase::getInstance()->deleteDirectoryEntries(path, true) > 0) {
+        emit signalFileChanged(path);
+    }
 }
 
 void ZSInotify::fileDeleted(QString path) {
-    int length = ZSSettings::getInstance()->getZeroSyncDirectory().length();
-    path.remove(0, length);
+    path = relativePath(path);
+    ZSFileHasher::forget(path);
 
     ZSDatabase::getInstance()->setFileChanged(path, 1);
     ZSDatabase::getInstance()->setFileUpdated(path, 0);
     ZSDatabase::getInstance()->setFileDeleted(path, 1);
     ZSDatabase::getInstance()->setFileTimestamp(path, QDateTime::currentDateTime().toUTC().toMSecsSinceEpoch());
-}
-
-
-QString ZSInotify::calculateHash(QString path)
-{
-    QCryptographicHash cryptoHash(QCryptographicHash::Sha3_512);
-    QFile file(path);
-    file.open(QFile::ReadOnly);
-    cryptoHash.addData(file.readAll());
-    QByteArray hashValue = cryptoHash.result();
-    return hashValue.toHex();
+    emit signalFileChanged(path);
 }
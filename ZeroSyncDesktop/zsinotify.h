@@ -26,31 +26,123 @@
 #define ZSINOTIFY_H
 
 #include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QFileInfo>
 #include <QDateTime>
 #include <QCryptographicHash>
+#include <QHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QtDebug>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
 #include <sys/inotify.h>
 #include "zssettings.h"
 #include "zsdatabase.h"
+#include "zsfilehasher.h"
+#include "zseventcoalescer.h"
 
 class ZSInotify : public QThread
 {
     Q_OBJECT
 
 public:
+    explicit ZSInotify(QObject *parent = 0);
     void run() Q_DECL_OVERRIDE;
     void handler(struct inotify_event *event);
 
+    //!  DirectoryRescanned-Method
+    /*!
+      Called from the watcher thread when a rescan of the directory finished, with the
+      directory mtime taken before it was read. The watch picks it up on its next wakeup,
+      so a later queue overflow only suspects the directory if it changed after the rescan.
+    */
+    void directoryRescanned(QString path, qint64 mtime);
+
 signals:
     void resultReady(const QString &s);
 
+    //!  RescanRequested-Signal
+    /*!
+      Emitted for directories whose events may have been lost, either because the
+      kernel queue overflowed or because the directory appeared before its watch.
+    */
+    void signalRescanRequested(QString, bool);
+
+    //!  QueueOverflow-Signal
+    /*!
+      Emitted when the kernel dropped events because the inotify queue overflowed.
+    */
+    void signalQueueOverflow();
+
+    //!  FileChanged-Signal
+    /*!
+      Emitted with the relative path after a settled or deleted file was processed.
+    */
+    void signalFileChanged(QString);
+
 private:
-    QString calculateHash(QString path);
+    //!  PendingMove-Struct
+    /*!
+      Holds the IN_MOVED_FROM half of a move until the matching IN_MOVED_TO
+      with the same cookie arrives or the pairing window expires.
+    */
+    struct PendingMove
+    {
+        QString path;
+        bool isDir;
+        bool settling;
+        qint64 time;
+    };
+
+    //!  WatchedDirectory-Struct
+    /*!
+      Holds the path of a watch together with the directory mtime at the time it
+      was last scanned and the time of its latest event, which are used to pick
+      the directories to rescan after a queue overflow.
+    */
+    struct WatchedDirectory
+    {
+        QString path;
+        qint64 mtime;
+        qint64 lastEvent;
+    };
+
+    //!  Pending moves by inotify cookie
+    QHash<quint32, PendingMove> pendingMoves;
+
+    //!  Watched directories by watch descriptor and vice versa
+    QHash<int, WatchedDirectory> watchedDirectories;
+    QHash<QString, int> watchDescriptors;
+
+    //!  Directory mtimes of finished rescans, waiting to be taken over by the watches
+    QHash<QString, qint64> rescannedDirectories;
+    QMutex rescannedDirectoriesMutex;
+
+    //!  Coalescer that merges write events until a file settled
+    ZSEventCoalescer *coalescer;
+
+    int inotify;
+    QString syncDirectory;
+
+    int nextTimeout(qint64 now);
+    void processSettledFiles(qint64 now);
+    void addWatch(QString path, bool recursive);
+    void removeWatches(QString path);
+    void renameWatches(QString oldPath, QString newPath);
+    void queueOverflowed();
+    void applyRescannedDirectories();
+    QString relativePath(QString path);
+    void expirePendingMoves(qint64 now);
     void fileUpdated(QString path);
-    void fileMovedIn(QString path, quint32 ref);
+    void fileMovedIn(QString path);
     void fileMovedOut(QString path, quint32 ref);
+    void fileRenamed(QString oldPath, QString newPath);
     void fileDeleted(QString path);
+    void directoryDeleted(QString path);
 
 public slots:
 
@@ -65,3 +65,63 @@ int ZSSettings::getSyncInterval()
 {
     return settings.value("syncinterval").toInt();
 }
+
+
+void ZSSettings::setCoalesceWindow(int milliseconds)
+{
+    settings.setValue("coalescewindow", milliseconds);
+}
+
+
+int ZSSettings::getCoalesceWindow()
+{
+    return settings.value("coalescewindow", 500).toInt();
+}
+
+
+void ZSSettings::setTransfersPerPeer(int transfers)
+{
+    settings.setValue("transfersperpeer", transfers);
+}
+
+
+int ZSSettings::getTransfersPerPeer()
+{
+    return qMax(1, settings.value("transfersperpeer", 4).toInt());
+}
+
+
+void ZSSettings::setPriorityPaths(QStringList paths)
+{
+    settings.setValue("prioritypaths", paths);
+}
+
+
+QStringList ZSSettings::getPriorityPaths()
+{
+    return settings.value("prioritypaths").toStringList();
+}
+
+
+void ZSSettings::setChunkCompression(bool enabled)
+{
+    settings.setValue("chunkcompression", enabled);
+}
+
+
+bool ZSSettings::getChunkCompression()
+{
+    return settings.value("chunkcompression", false).toBool();
+}
+
+
+void ZSSettings::setSmallFilePacks(bool enabled)
+{
+    settings.setValue("smallfilepacks", enabled);
+}
+
+
+bool ZSSettings::getSmallFilePacks()
+{
+    return settings.value("smallfilepacks", false).toBool();
+}
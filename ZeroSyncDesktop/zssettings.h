@@ -29,6 +29,7 @@
 #include <QObject>
 #include <QSettings>
 #include <QMutex>
+#include <QStringList>
 
 
 //!  Class that provides the local ZeroSync settings
@@ -103,6 +104,66 @@ public:
     */
     int getSyncInterval();
 
+    //!  SetCoalesceWindow-Method
+    /*!
+      Is used to save the quiet window in milliseconds after which a changed file counts as settled.
+    */
+    void setCoalesceWindow(int);
+
+    //!  GetCoalesceWindow-Method
+    /*!
+      Is used to load the quiet window for change coalescing, 500 milliseconds if not set.
+    */
+    int getCoalesceWindow();
+
+    //!  SetTransfersPerPeer-Method
+    /*!
+      Is used to save how many files are received from one peer at the same time.
+    */
+    void setTransfersPerPeer(int);
+
+    //!  GetTransfersPerPeer-Method
+    /*!
+      Is used to load the number of concurrent files per peer, 4 if not set.
+    */
+    int getTransfersPerPeer();
+
+    //!  SetPriorityPaths-Method
+    /*!
+      Is used to save the paths relative to the ZeroSync directory that are received first.
+    */
+    void setPriorityPaths(QStringList);
+
+    //!  GetPriorityPaths-Method
+    /*!
+      Is used to load the paths that are received first.
+    */
+    QStringList getPriorityPaths();
+
+    //!  SetChunkCompression-Method
+    /*!
+      Is used to save whether chunks are sent compressed, all peers of a share have to agree.
+    */
+    void setChunkCompression(bool);
+
+    //!  GetChunkCompression-Method
+    /*!
+      Is used to load whether chunks are sent compressed, off if not set.
+    */
+    bool getChunkCompression();
+
+    //!  SetSmallFilePacks-Method
+    /*!
+      Is used to save whether small files are requested in packs, all peers of a share have to support it.
+    */
+    void setSmallFilePacks(bool);
+
+    //!  GetSmallFilePacks-Method
+    /*!
+      Is used to load whether small files are requested in packs, off if not set.
+    */
+    bool getSmallFilePacks();
+
 private:
     //!  "Disabled" Constructor
     /*!
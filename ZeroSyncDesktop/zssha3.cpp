@@ -0,0 +1,204 @@
+/* =========================================================================
+   ZSSha3 - SHA3-512 with a state that can be saved and resumed
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zssha3.h"
+
+#include <cstring>
+
+static const quint64 ROUND_CONSTANTS[24] =
+{
+    Q_UINT64_C(0x0000000000000001), Q_UINT64_C(0x0000000000008082), Q_UINT64_C(0x800000000000808a),
+    Q_UINT64_C(0x8000000080008000), Q_UINT64_C(0x000000000000808b), Q_UINT64_C(0x0000000080000001),
+    Q_UINT64_C(0x8000000080008081), Q_UINT64_C(0x8000000000008009), Q_UINT64_C(0x000000000000008a),
+    Q_UINT64_C(0x0000000000000088), Q_UINT64_C(0x0000000080008009), Q_UINT64_C(0x000000008000000a),
+    Q_UINT64_C(0x000000008000808b), Q_UINT64_C(0x800000000000008b), Q_UINT64_C(0x8000000000008089),
+    Q_UINT64_C(0x8000000000008003), Q_UINT64_C(0x8000000000008002), Q_UINT64_C(0x8000000000000080),
+    Q_UINT64_C(0x000000000000800a), Q_UINT64_C(0x800000008000000a), Q_UINT64_C(0x8000000080008081),
+    Q_UINT64_C(0x8000000000008080), Q_UINT64_C(0x0000000080000001), Q_UINT64_C(0x8000000080008008)
+};
+
+static const int ROTATIONS[24] =
+{
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
+};
+
+static const int PI_LANES[24] =
+{
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
+};
+
+static inline quint64 rotateLeft(quint64 value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+
+ZSSha3::ZSSha3()
+{
+    reset();
+}
+
+
+void ZSSha3::reset()
+{
+    memset(state, 0, sizeof(state));
+    buffered = 0;
+}
+
+
+void ZSSha3::addData(const char *data, qint64 length)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    if(buffered > 0)
+    {
+        int take = (int) qMin((qint64) (RATE - buffered), length);
+        memcpy(buffer + buffered, bytes, take);
+        buffered += take;
+        bytes += take;
+        length -= take;
+        if(buffered < RATE)
+        {
+            return;
+        }
+        absorb(state, buffer);
+        buffered = 0;
+    }
+    while(length >= RATE)
+    {
+        absorb(state, bytes);
+        bytes += RATE;
+        length -= RATE;
+    }
+    memcpy(buffer, bytes, length);
+    buffered = (int) length;
+}
+
+
+QByteArray ZSSha3::result() const
+{
+    quint64 finalState[25];
+    uchar finalBlock[RATE];
+    memcpy(finalState, state, sizeof(state));
+    memcpy(finalBlock, buffer, buffered);
+    memset(finalBlock + buffered, 0, RATE - buffered);
+    // SHA3 domain separation and pad10*1
+    finalBlock[buffered] ^= 0x06;
+    finalBlock[RATE - 1] ^= 0x80;
+    absorb(finalState, finalBlock);
+
+    QByteArray digest(64, Qt::Uninitialized);
+    for(int i = 0; i < 8; i++)
+    {
+        qToLittleEndian(finalState[i], reinterpret_cast<uchar *>(digest.data()) + i * 8);
+    }
+    return digest;
+}
+
+
+QByteArray ZSSha3::saveState() const
+{
+    QByteArray savedState(STATE_SIZE, Qt::Uninitialized);
+    for(int i = 0; i < 25; i++)
+    {
+        qToLittleEndian(state[i], reinterpret_cast<uchar *>(savedState.data()) + i * 8);
+    }
+    savedState.append(reinterpret_cast<const char *>(buffer), buffered);
+    return savedState;
+}
+
+
+bool ZSSha3::restoreState(const QByteArray &savedState)
+{
+    if(savedState.size() < STATE_SIZE || savedState.size() >= STATE_SIZE + RATE)
+    {
+        return false;
+    }
+    const uchar *bytes = reinterpret_cast<const uchar *>(savedState.constData());
+    for(int i = 0; i < 25; i++)
+    {
+        state[i] = qFromLittleEndian<quint64>(bytes + i * 8);
+    }
+    buffered = savedState.size() - STATE_SIZE;
+    memcpy(buffer, bytes + STATE_SIZE, buffered);
+    return true;
+}
+
+
+void ZSSha3::absorb(quint64 *state, const uchar *block)
+{
+    for(int i = 0; i < RATE / 8; i++)
+    {
+        state[i] ^= qFromLittleEndian<quint64>(block + i * 8);
+    }
+    permute(state);
+}
+
+
+void ZSSha3::permute(quint64 *state)
+{
+    quint64 columns[5];
+    for(int round = 0; round < 24; round++)
+    {
+        // Theta
+        for(int x = 0; x < 5; x++)
+        {
+            columns[x] = state[x] ^ state[x + 5] ^ state[x + 10] ^ state[x + 15] ^ state[x + 20];
+        }
+        for(int x = 0; x < 5; x++)
+        {
+            quint64 mix = columns[(x + 4) % 5] ^ rotateLeft(columns[(x + 1) % 5], 1);
+            for(int y = 0; y < 25; y += 5)
+            {
+                state[x + y] ^= mix;
+            }
+        }
+
+        // Rho and pi
+        quint64 carried = state[1];
+        for(int i = 0; i < 24; i++)
+        {
+            int lane = PI_LANES[i];
+            quint64 displaced = state[lane];
+            state[lane] = rotateLeft(carried, ROTATIONS[i]);
+            carried = displaced;
+        }
+
+        // Chi
+        for(int y = 0; y < 25; y += 5)
+        {
+            for(int x = 0; x < 5; x++)
+            {
+                columns[x] = state[x + y];
+            }
+            for(int x = 0; x < 5; x++)
+            {
+                state[x + y] = columns[x] ^ (~columns[(x + 1) % 5] & columns[(x + 2) % 5]);
+            }
+        }
+
+        // Iota
+        state[0] ^= ROUND_CONSTANTS[round];
+    }
+}
@@ -0,0 +1,83 @@
+/* =========================================================================
+   ZSSha3 - SHA3-512 with a state that can be saved and resumed
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSSHA3_H
+#define ZSSHA3_H
+
+#include <QByteArray>
+#include <QtEndian>
+
+
+//!  Class that calculates SHA3-512 hashes
+/*!
+  This class calculates SHA3-512 as specified in FIPS 202, which is what
+  QCryptographicHash::Sha3_512 computes from Qt 5.9 on, but its state can be saved
+  after any amount of data and restored later. Hashing a file that only grew can so
+  continue where the last hash ended.
+*/
+class ZSSha3
+{
+public:
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    ZSSha3();
+
+    void reset();
+    void addData(const char *data, qint64 length);
+
+    //!  Result-Method
+    /*!
+      Returns the hash of the data added so far. More data can be added afterwards.
+    */
+    QByteArray result() const;
+
+    //!  SaveState-Method
+    /*!
+      Returns the state of the hash, to be restored with restoreState().
+    */
+    QByteArray saveState() const;
+
+    //!  RestoreState-Method
+    /*!
+      Continues from a saved state. Returns false if the state is not valid.
+    */
+    bool restoreState(const QByteArray &savedState);
+
+private:
+    //!  Bytes absorbed per permutation for a 512 bit output
+    static const int RATE = 72;
+    static const int STATE_SIZE = 200;
+
+    quint64 state[25];
+    uchar buffer[RATE];
+    int buffered;
+
+    static void absorb(quint64 *state, const uchar *block);
+    static void permute(quint64 *state);
+};
+
+#endif // ZSSHA3_H
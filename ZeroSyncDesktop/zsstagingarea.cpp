@@ -0,0 +1,564 @@
+/* =========================================================================
+   ZSStagingArea - Receives files into staging files before they go live
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zsstagingarea.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+
+// Received ranges are made durable after this many bytes or milliseconds, whatever comes first
+static const qint64 CHECKPOINT_BYTES = 64 * 1024 * 1024;
+static const qint64 CHECKPOINT_INTERVAL = 5000;
+
+// Partial files of transfers that were not announced again for this long are dropped
+static const qint64 TRANSFER_EXPIRY = Q_INT64_C(7) * 24 * 60 * 60 * 1000;
+
+// Shares the extents of the source if the filesystem can, copies in the kernel or by reads otherwise
+static bool cloneFile(int source, int destination, qint64 size)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    if(ioctl(destination, FICLONE, source) == 0)
+    {
+        return true;
+    }
+#endif
+
+    qint64 copied = 0;
+#ifdef Q_OS_LINUX
+    while(copied < size)
+    {
+        loff_t sourceOffset = copied;
+        loff_t destinationOffset = copied;
+        ssize_t count = copy_file_range(source, &sourceOffset, destination, &destinationOffset, size - copied, 0);
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count <= 0)
+        {
+            break;
+        }
+        copied += count;
+    }
+#endif
+
+    char buffer[64 * 1024];
+    while(copied < size)
+    {
+        ssize_t count = pread(source, buffer, qMin((qint64) sizeof(buffer), size - copied), copied);
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count <= 0)
+        {
+            return false;
+        }
+        for(ssize_t written = 0; written < count; )
+        {
+            ssize_t result = pwrite(destination, buffer + written, count - written, copied + written);
+            if(result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(result <= 0)
+            {
+                return false;
+            }
+            written += result;
+        }
+        copied += count;
+    }
+    return true;
+}
+
+
+ZSStagingArea::ZSStagingArea(QObject *parent) :
+    QObject(parent)
+{
+}
+
+
+ZSStagingArea::~ZSStagingArea()
+{
+    QMutexLocker locker(&mutex);
+    // Unfinished transfers continue after the next start
+    for(QHash<QString, StagedFile>::iterator stagedFile = stagedFiles.begin(); stagedFile != stagedFiles.end(); ++stagedFile)
+    {
+        if(stagedFile->descriptor >= 0)
+        {
+            checkpoint(*stagedFile);
+            close(stagedFile->descriptor);
+        }
+    }
+    stagedFiles.clear();
+}
+
+
+void ZSStagingArea::restoreTransfers()
+{
+    QMutexLocker locker(&mutex);
+    QSet<QString> stagingFiles;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QSqlQuery query = ZSDatabase::getInstance()->fetchAllTransfers();
+    while(query.next())
+    {
+        StagedFile stagedFile;
+        stagedFile.path = query.value(0).toString();
+        stagedFile.descriptor = -1;
+        stagedFile.stagingPath = stagingFileName(stagedFile.path);
+        stagedFile.size = query.value(1).toLongLong();
+        stagedFile.checksum = query.value(2).toString().toULongLong(0, 16);
+        QDataStream stream(query.value(3).toByteArray());
+        stream >> stagedFile.ranges;
+        qint64 updated = query.value(4).toLongLong();
+
+        stagedFile.received = 0;
+        for(QMap<qint64, qint64>::const_iterator range = stagedFile.ranges.constBegin(); range != stagedFile.ranges.constEnd(); ++range)
+        {
+            stagedFile.received += range.value() - range.key();
+        }
+        stagedFile.checkpointed = stagedFile.received;
+        stagedFile.checkpointTime = now;
+        initializeHash(stagedFile);
+
+        if(now - updated > TRANSFER_EXPIRY || !QFileInfo(QString::fromLocal8Bit(stagedFile.stagingPath)).isFile())
+        {
+            discard(stagedFile);
+            continue;
+        }
+        stagingFiles.insert(QFileInfo(QString::fromLocal8Bit(stagedFile.stagingPath)).fileName());
+        stagedFiles.insert(stagedFile.path, stagedFile);
+    }
+
+    // Staging files without a recorded transfer are left over from a crash before the first checkpoint
+    QDir stagingDirectory(getStagingDirectory());
+    foreach(const QString &fileName, stagingDirectory.entryList(QStringList() << "*.part", QDir::Files))
+    {
+        if(!stagingFiles.contains(fileName))
+        {
+            stagingDirectory.remove(fileName);
+        }
+    }
+}
+
+
+void ZSStagingArea::expectFile(QString path, qint64 size, quint64 checksum)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, StagedFile>::iterator running = stagedFiles.find(path);
+    if(running != stagedFiles.end())
+    {
+        // The same content again continues with the ranges received so far
+        if(running->size == size && running->checksum == checksum && checksum != 0)
+        {
+            return;
+        }
+        // A newer announcement replaces a transfer that is still running
+        discard(*running);
+        stagedFiles.erase(running);
+    }
+
+    StagedFile stagedFile;
+    stagedFile.path = path;
+    stagedFile.descriptor = -1;
+    stagedFile.size = size;
+    stagedFile.checksum = checksum;
+    stagedFile.received = 0;
+    stagedFile.checkpointed = 0;
+    stagedFile.checkpointTime = QDateTime::currentMSecsSinceEpoch();
+    initializeHash(stagedFile);
+    stagedFiles.insert(path, stagedFile);
+}
+
+
+bool ZSStagingArea::writeChunk(QString path, qint64 offset, const char *data, qint64 length)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, StagedFile>::iterator stagedFile = stagedFiles.find(path);
+    if(stagedFile == stagedFiles.end())
+    {
+        qDebug() << "Error - ZSStagingArea::writeChunk() failed: No transfer expected for" << path;
+        return false;
+    }
+    if(stagedFile->descriptor < 0 && !openStagingFile(path, *stagedFile))
+    {
+        // A restored transfer leaves its row and partial staging file behind otherwise
+        discard(*stagedFile);
+        stagedFiles.erase(stagedFile);
+        return false;
+    }
+
+    qint64 written = 0;
+    while(written < length)
+    {
+        ssize_t count = pwrite(stagedFile->descriptor, data + written, length - written, offset + written);
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count <= 0)
+        {
+            qDebug() << "Error - ZSStagingArea::writeChunk() failed for" << path << ": " << strerror(errno);
+            discard(*stagedFile);
+            stagedFiles.erase(stagedFile);
+            return false;
+        }
+        written += count;
+    }
+    // Chunks sent again after a reconnect are not counted twice
+    stagedFile->received += ZSStagingArea::addRange(stagedFile->ranges, offset, offset + length);
+    if(offset == stagedFile->hashed)
+    {
+        stagedFile->sha3->addData(data, length);
+        stagedFile->chunker->addData(data, length);
+        stagedFile->hashed += length;
+    }
+
+    if(stagedFile->received < stagedFile->size)
+    {
+        if(stagedFile->received - stagedFile->checkpointed >= CHECKPOINT_BYTES
+                || QDateTime::currentMSecsSinceEpoch() - stagedFile->checkpointTime >= CHECKPOINT_INTERVAL)
+        {
+            checkpoint(*stagedFile);
+        }
+        return false;
+    }
+    bool committed = commit(path, *stagedFile);
+    stagedFiles.erase(stagedFile);
+    return committed;
+}
+
+
+bool ZSStagingArea::copyLocalFile(QString path, qint64 size, quint64 checksum)
+{
+    if(checksum == 0)
+    {
+        return false;
+    }
+    QString source = ZSDatabase::getInstance()->getFilePathForChecksumPrefix(QString("%1").arg(checksum, 16, 16, QChar('0')), size);
+    if(source.isEmpty())
+    {
+        return false;
+    }
+    QString zeroSyncDirectory = ZSSettings::getInstance()->getZeroSyncDirectory();
+    QFileInfo sourceInfo(zeroSyncDirectory + "/" + source);
+
+    // The recorded checksum only counts for the path itself while the file is as it was hashed
+    if(source == path)
+    {
+        return sourceInfo.size() == size
+                && sourceInfo.lastModified().toMSecsSinceEpoch() == ZSDatabase::getInstance()->getTimestampForFile(path);
+    }
+
+    QMutexLocker locker(&mutex);
+    if(stagedFiles.contains(path))
+    {
+        return false;
+    }
+    StagedFile stagedFile;
+    stagedFile.path = path;
+    stagedFile.descriptor = -1;
+    stagedFile.size = size;
+    stagedFile.checksum = checksum;
+    stagedFile.received = 0;
+    stagedFile.checkpointed = 0;
+    initializeHash(stagedFile);
+    if(!openStagingFile(path, stagedFile, false))
+    {
+        return false;
+    }
+
+    int sourceDescriptor = open(sourceInfo.absoluteFilePath().toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if(sourceDescriptor < 0 || !cloneFile(sourceDescriptor, stagedFile.descriptor, size))
+    {
+        qDebug() << "Error - ZSStagingArea::copyLocalFile() failed to copy" << source << "to" << path << ": " << strerror(errno);
+        if(sourceDescriptor >= 0)
+        {
+            close(sourceDescriptor);
+        }
+        discard(stagedFile);
+        return false;
+    }
+    close(sourceDescriptor);
+
+    // The copy is checked against the announced checksum like a received file
+    stagedFile.received = size;
+    return commit(path, stagedFile);
+}
+
+
+void ZSStagingArea::suspend(QString path)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, StagedFile>::iterator stagedFile = stagedFiles.find(path);
+    if(stagedFile != stagedFiles.end() && stagedFile->descriptor >= 0)
+    {
+        checkpoint(*stagedFile);
+        close(stagedFile->descriptor);
+        stagedFile->descriptor = -1;
+    }
+}
+
+
+QList<QPair<qint64, qint64> > ZSStagingArea::getMissingRanges(QString path)
+{
+    QMutexLocker locker(&mutex);
+    QList<QPair<qint64, qint64> > missingRanges;
+    QHash<QString, StagedFile>::const_iterator stagedFile = stagedFiles.constFind(path);
+    if(stagedFile == stagedFiles.constEnd())
+    {
+        return missingRanges;
+    }
+    qint64 position = 0;
+    for(QMap<qint64, qint64>::const_iterator range = stagedFile->ranges.constBegin(); range != stagedFile->ranges.constEnd(); ++range)
+    {
+        if(range.key() > position)
+        {
+            missingRanges.append(qMakePair(position, range.key()));
+        }
+        position = range.value();
+    }
+    if(position < stagedFile->size)
+    {
+        missingRanges.append(qMakePair(position, stagedFile->size));
+    }
+    return missingRanges;
+}
+
+
+bool ZSStagingArea::isExpected(QString path)
+{
+    QMutexLocker locker(&mutex);
+    return stagedFiles.contains(path);
+}
+
+
+void ZSStagingArea::abort(QString path)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, StagedFile>::iterator stagedFile = stagedFiles.find(path);
+    if(stagedFile != stagedFiles.end())
+    {
+        discard(*stagedFile);
+        stagedFiles.erase(stagedFile);
+    }
+}
+
+
+QString ZSStagingArea::getStagingDirectory()
+{
+    return ZSSettings::getInstance()->getZeroSyncDirectory().append("/.zerosync/staging");
+}
+
+
+qint64 ZSStagingArea::addRange(QMap<qint64, qint64> &ranges, qint64 start, qint64 end)
+{
+    qint64 covered = 0;
+    QMap<qint64, qint64>::iterator range = ranges.upperBound(start);
+    if(range != ranges.begin())
+    {
+        --range;
+        if(range.value() < start)
+        {
+            ++range;
+        }
+    }
+    while(range != ranges.end() && range.key() <= end)
+    {
+        start = qMin(start, range.key());
+        end = qMax(end, range.value());
+        covered += range.value() - range.key();
+        range = ranges.erase(range);
+    }
+    ranges.insert(start, end);
+    return (end - start) - covered;
+}
+
+
+quint64 ZSStagingArea::checksumPrefix(QString checksum)
+{
+    return checksum.left(16).toULongLong(0, 16);
+}
+
+
+bool ZSStagingArea::openStagingFile(QString path, StagedFile &stagedFile, bool preallocate)
+{
+    // Hidden below the ZeroSync directory, so it is on the same filesystem but not watched
+    QDir().mkpath(getStagingDirectory());
+    stagedFile.stagingPath = stagingFileName(path);
+
+    // A transfer with received ranges continues in its staging file
+    int flags = stagedFile.ranges.isEmpty() ? O_TRUNC : 0;
+    stagedFile.descriptor = open(stagedFile.stagingPath.constData(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+    if(stagedFile.descriptor < 0)
+    {
+        qDebug() << "Error - ZSStagingArea::openStagingFile() failed for" << path << ": " << strerror(errno);
+        return false;
+    }
+
+    // Reserves the space up front, so the file is not fragmented and a full disk fails early
+    if(preallocate && stagedFile.size > 0)
+    {
+        int result = posix_fallocate(stagedFile.descriptor, 0, stagedFile.size);
+        if(result == ENOSPC)
+        {
+            qDebug() << "Error - ZSStagingArea::openStagingFile() failed for" << path << ": " << strerror(result);
+            discard(stagedFile);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool ZSStagingArea::commit(QString path, StagedFile &stagedFile)
+{
+    close(stagedFile.descriptor);
+    stagedFile.descriptor = -1;
+    if(stagedFile.checkpointed > 0)
+    {
+        ZSDatabase::getInstance()->removeTransfer(path);
+        stagedFile.checkpointed = 0;
+    }
+
+    QString checksum;
+    QList<ZSChunk> chunks;
+    if(!finishHash(stagedFile, checksum, chunks))
+    {
+        discard(stagedFile);
+        return false;
+    }
+    if(stagedFile.checksum != 0 && checksumPrefix(checksum) != stagedFile.checksum)
+    {
+        qDebug() << "Error - ZSStagingArea::commit() failed for" << path << ": Checksum does not match the announced one";
+        discard(stagedFile);
+        return false;
+    }
+
+    QString destination = ZSSettings::getInstance()->getZeroSyncDirectory().append("/").append(path);
+    QDir().mkpath(QFileInfo(destination).absolutePath());
+    QFileInfo stagedInfo(QString::fromLocal8Bit(stagedFile.stagingPath));
+    ZSExpectedWrites::getInstance()->expect(path, stagedInfo.size(), stagedInfo.lastModified().toUTC().toMSecsSinceEpoch(), checksum, chunks, true);
+    // Only marks a file that is known already, a new one is marked when the watcher inserts it
+    ZSDatabase::getInstance()->setFileChanged(path, 1);
+    ZSDatabase::getInstance()->setFileChangedSelf(path, 1);
+    if(rename(stagedFile.stagingPath.constData(), destination.toLocal8Bit().constData()) != 0)
+    {
+        qDebug() << "Error - ZSStagingArea::commit() failed for" << path << ": " << strerror(errno);
+        discard(stagedFile);
+        return false;
+    }
+    return true;
+}
+
+
+void ZSStagingArea::discard(StagedFile &stagedFile)
+{
+    if(stagedFile.descriptor >= 0)
+    {
+        close(stagedFile.descriptor);
+        stagedFile.descriptor = -1;
+    }
+    if(stagedFile.checkpointed > 0)
+    {
+        ZSDatabase::getInstance()->removeTransfer(stagedFile.path);
+        stagedFile.checkpointed = 0;
+    }
+    if(!stagedFile.stagingPath.isEmpty())
+    {
+        unlink(stagedFile.stagingPath.constData());
+    }
+}
+
+
+void ZSStagingArea::checkpoint(StagedFile &stagedFile)
+{
+    if(stagedFile.received == stagedFile.checkpointed)
+    {
+        return;
+    }
+    // The ranges may only claim what is on disk, otherwise a crash leaves holes that count as received
+    if(fdatasync(stagedFile.descriptor) != 0)
+    {
+        qDebug() << "Error - ZSStagingArea::checkpoint() failed for" << stagedFile.path << ": " << strerror(errno);
+        return;
+    }
+    QByteArray ranges;
+    QDataStream stream(&ranges, QIODevice::WriteOnly);
+    stream << stagedFile.ranges;
+    ZSDatabase::getInstance()->setTransfer(stagedFile.path, stagedFile.size, QString::number(stagedFile.checksum, 16), ranges);
+    stagedFile.checkpointed = stagedFile.received;
+    stagedFile.checkpointTime = QDateTime::currentMSecsSinceEpoch();
+}
+
+
+QByteArray ZSStagingArea::stagingFileName(QString path)
+{
+    QByteArray name = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QString(getStagingDirectory() + "/" + name + ".part").toLocal8Bit();
+}
+
+
+void ZSStagingArea::initializeHash(StagedFile &stagedFile)
+{
+    stagedFile.sha3 = QSharedPointer<ZSSha3>(new ZSSha3());
+    stagedFile.chunker = QSharedPointer<ZSChunker>(new ZSChunker());
+    stagedFile.hashed = 0;
+}
+
+
+bool ZSStagingArea::finishHash(StagedFile &stagedFile, QString &checksum, QList<ZSChunk> &chunks)
+{
+    // Only what did not arrive in order is read back
+    if(stagedFile.hashed < stagedFile.size)
+    {
+        QFile file(QString::fromLocal8Bit(stagedFile.stagingPath));
+        if(!file.open(QFile::ReadOnly) || !file.seek(stagedFile.hashed))
+        {
+            qDebug() << "Error - ZSStagingArea::finishHash() failed for" << stagedFile.path << ":" << file.errorString();
+            return false;
+        }
+        QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+        qint64 length;
+        while(stagedFile.hashed < stagedFile.size && (length = file.read(buffer.data(), qMin((qint64) buffer.size(), stagedFile.size - stagedFile.hashed))) > 0)
+        {
+            stagedFile.sha3->addData(buffer.constData(), length);
+            stagedFile.chunker->addData(buffer.constData(), length);
+            stagedFile.hashed += length;
+        }
+    }
+    checksum = stagedFile.sha3->result().toHex();
+    chunks = stagedFile.chunker->takeChunks();
+    return stagedFile.hashed == stagedFile.size;
+}
@@ -0,0 +1,192 @@
+/* =========================================================================
+   ZSStagingArea - Receives files into staging files before they go live
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSSTAGINGAREA_H
+#define ZSSTAGINGAREA_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QList>
+#include <QPair>
+#include <QDataStream>
+#include <QSqlQuery>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QByteArray>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QtDebug>
+#include "zssettings.h"
+#include "zsdatabase.h"
+#include "zsfilehasher.h"
+#include "zsexpectedwrites.h"
+
+
+//!  Class that stages incoming files
+/*!
+  Files received from peers are not written to their destination directly. They
+  are written into a staging file in the hidden .zerosync directory on the same
+  filesystem, preallocated to the announced size and written with positional
+  writes on a descriptor that stays open for the whole transfer. Once all bytes
+  arrived the content is verified against the announced checksum and the staging
+  file is renamed over the destination, so readers see either the old or the new
+  file but never a partial one.
+
+  The received byte ranges of a transfer are recorded in the database from time to
+  time, after the staging file was synced. A transfer that is announced again with
+  the same checksum, after a reconnect or a restart, continues with these ranges.
+
+  Chunks that arrive in order are hashed right away, so the checksum is known when
+  the last one arrived; only content that arrived out of order is read back. The
+  checksum and the chunks are registered in ZSExpectedWrites before the file is
+  moved into place, so the watcher does not hash it again.
+*/
+class ZSStagingArea : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The default constructor.
+    */
+    explicit ZSStagingArea(QObject *parent = 0);
+
+    //!  Destructor
+    /*!
+      Closes the staging files of unfinished transfers.
+    */
+    ~ZSStagingArea();
+
+    //!  RestoreTransfers-Method
+    /*!
+      Loads the unfinished transfers recorded before the last shutdown and removes
+      staging files that belong to none of them.
+    */
+    void restoreTransfers();
+
+    //!  ExpectFile-Method
+    /*!
+      Announces a file that was requested from a peer with the size and the checksum
+      from its update. A checksum of 0 is not verified. An unfinished transfer of the
+      same content is continued.
+    */
+    void expectFile(QString path, qint64 size, quint64 checksum);
+
+    //!  WriteChunk-Method
+    /*!
+      Writes the chunk to the staging file of the path. Returns true if this completed
+      the file and it was moved to its destination.
+    */
+    bool writeChunk(QString path, qint64 offset, const char *data, qint64 length);
+
+    //!  CopyLocalFile-Method
+    /*!
+      Satisfies an announced file from a local file with the same size and checksum,
+      cloned with a reflink where the filesystem supports it and copied otherwise.
+      Returns true if no transfer is needed, because the copy was committed or the
+      path already holds the content.
+    */
+    bool copyLocalFile(QString path, qint64 size, quint64 checksum);
+
+    //!  Suspend-Method
+    /*!
+      Records the received ranges of the path and closes its staging file, the transfer
+      continues when the file is announced again.
+    */
+    void suspend(QString path);
+
+    //!  GetMissingRanges-Method
+    /*!
+      Returns the byte ranges [first, second) of the path that were not received yet.
+    */
+    QList<QPair<qint64, qint64> > getMissingRanges(QString path);
+
+    //!  IsExpected-Method
+    /*!
+      Returns true while the transfer of the path is neither committed nor dropped.
+    */
+    bool isExpected(QString path);
+
+    //!  Abort-Method
+    /*!
+      Drops the transfer of the path and removes its staging file.
+    */
+    void abort(QString path);
+
+    //!  GetStagingDirectory-Method
+    /*!
+      Returns the directory of the staging files below the ZeroSync directory.
+    */
+    static QString getStagingDirectory();
+
+    //!  ChecksumPrefix-Method
+    /*!
+      Returns the first 64 bits of a hex encoded checksum, as announced to peers.
+    */
+    static quint64 checksumPrefix(QString checksum);
+
+    //!  AddRange-Method
+    /*!
+      Adds [start, end) to the disjoint ranges keyed by start, returns the number of
+      bytes that were not covered yet.
+    */
+    static qint64 addRange(QMap<qint64, qint64> &ranges, qint64 start, qint64 end);
+
+private:
+    struct StagedFile
+    {
+        QString path;
+        int descriptor;
+        QByteArray stagingPath;
+        qint64 size;
+        quint64 checksum;
+        qint64 received;
+        QMap<qint64, qint64> ranges;
+        qint64 checkpointed;
+        qint64 checkpointTime;
+        QSharedPointer<ZSSha3> sha3;
+        QSharedPointer<ZSChunker> chunker;
+        qint64 hashed;
+    };
+
+    QHash<QString, StagedFile> stagedFiles;
+    QMutex mutex;
+
+    bool openStagingFile(QString path, StagedFile &stagedFile, bool preallocate = true);
+    bool commit(QString path, StagedFile &stagedFile);
+    void discard(StagedFile &stagedFile);
+    void checkpoint(StagedFile &stagedFile);
+    void initializeHash(StagedFile &stagedFile);
+    bool finishHash(StagedFile &stagedFile, QString &checksum, QList<ZSChunk> &chunks);
+    static QByteArray stagingFileName(QString path);
+};
+
+#endif // ZSSTAGINGAREA_H
@@ -0,0 +1,516 @@
+/* =========================================================================
+   ZSTransferScheduler - Plans which files are received next
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zstransferscheduler.h"
+
+ZSTransferScheduler::ZSTransferScheduler(zsync_agent_t *agent, ZSStagingArea *stagingArea, ZSFilePack *filePack, QObject *parent) :
+    QObject(parent),
+    agent(agent),
+    stagingArea(stagingArea),
+    filePack(filePack),
+    sequence(0)
+{
+    priorityPaths = ZSSettings::getInstance()->getPriorityPaths();
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(slotMaintain()));
+    timer->start(30000);
+    timeoutTimer = new QTimer(this);
+    connect(timeoutTimer, SIGNAL(timeout()), this, SLOT(slotCheckTimeouts()));
+    timeoutTimer->start(1000);
+}
+
+
+void ZSTransferScheduler::enqueue(QString sender, QString path, qint64 size, quint64 checksum, qint64 timestamp)
+{
+    // Empty files need no transfer, they are committed through the staging area right away
+    if(size == 0)
+    {
+        mutex.lock();
+        if(pending.contains(path))
+        {
+            removePending(path);
+        }
+        mutex.unlock();
+        stagingArea->expectFile(path, 0, checksum);
+        stagingArea->writeChunk(path, 0, "", 0);
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    Transfer transfer;
+    transfer.sender = sender;
+    transfer.path = path;
+    transfer.size = size;
+    transfer.checksum = checksum;
+    transfer.timestamp = timestamp;
+    transfer.enqueued = now;
+    transfer.lastActivity = now;
+    transfer.requested = 0;
+    transfer.received = 0;
+    transfer.end = 0;
+    transfer.retries = 0;
+    transfer.key.priority = priorityOf(path, size, timestamp);
+    transfer.key.size = size;
+
+    // The newer update replaces the queued one and keeps its place in time
+    if(pending.contains(path))
+    {
+        transfer.enqueued = pending.value(path).enqueued;
+        removePending(path);
+    }
+    insertPending(transfer);
+}
+
+
+void ZSTransferScheduler::dispatch()
+{
+    if(QThread::currentThread() == thread())
+    {
+        slotDispatch();
+    }
+    else if(dispatchQueued.testAndSetOrdered(0, 1))
+    {
+        // Calls from other threads made meanwhile are served by the same queued call
+        QMetaObject::invokeMethod(this, "slotDispatch", Qt::QueuedConnection);
+    }
+}
+
+
+void ZSTransferScheduler::slotDispatch()
+{
+    dispatchQueued.store(0);
+    QHash<QString, QList<Transfer> > requests;
+    {
+        QMutexLocker locker(&mutex);
+        int transfersPerPeer = ZSSettings::getInstance()->getTransfersPerPeer();
+        bool smallFilePacks = ZSSettings::getInstance()->getSmallFilePacks();
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        QMutableHashIterator<QString, QMap<TransferKey, QString> > queue(queues);
+        while(queue.hasNext())
+        {
+            queue.next();
+            QString sender = queue.key();
+            PeerLink &link = links[sender];
+            QMap<TransferKey, QString>::iterator next = queue.value().begin();
+            while(next != queue.value().end())
+            {
+                // The configured number of files is always requested, more only while the window has room
+                int activeCount = activePerPeer.value(sender);
+                if(activeCount >= transfersPerPeer && (activeCount >= MAXIMUM_TRANSFERS_PER_PEER || link.inFlight >= windowOf(link)))
+                {
+                    break;
+                }
+                // A file still in flight is requested again once it finished
+                if(active.contains(next.value()) || packOf.contains(next.value()))
+                {
+                    ++next;
+                    continue;
+                }
+                Transfer transfer;
+                if(!smallFilePacks || pending.value(next.value()).size > ZSFilePack::MAXIMUM_ENTRY_SIZE || !takePack(sender, queue.value(), next, transfer))
+                {
+                    transfer = pending.take(next.value());
+                    next = queue.value().erase(next);
+                    stagingArea->expectFile(transfer.path, transfer.size, transfer.checksum);
+                }
+                transfer.lastActivity = now;
+                transfer.requested = now;
+                transfer.received = 0;
+                transfer.end = 0;
+                if(link.inFlight == 0)
+                {
+                    // The throughput is measured from the first chunk on, not from an idle link
+                    link.sampleStart = 0;
+                }
+                link.inFlight += transfer.size;
+                active.insert(transfer.path, transfer);
+                activePerPeer[sender]++;
+                requests[sender].append(transfer);
+            }
+            if(queue.value().isEmpty())
+            {
+                queue.remove();
+            }
+        }
+    }
+
+    QHashIterator<QString, QList<Transfer> > request(requests);
+    while(request.hasNext())
+    {
+        request.next();
+        zlist_t *requestList = zlist_new();
+        zlist_autofree(requestList);
+        uint64_t requestBytes = 0;
+        foreach(const Transfer &transfer, request.value())
+        {
+            zlist_append(requestList, transfer.path.toUtf8().data());
+            requestBytes += transfer.size;
+        }
+        zsync_agent_send_request_files(agent, request.key().toUtf8().data(), requestList, requestBytes);
+    }
+}
+
+
+void ZSTransferScheduler::progress(QString path, qint64 offset, qint64 length)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Transfer>::iterator transfer = active.find(path);
+    if(transfer == active.end())
+    {
+        return;
+    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    PeerLink &link = links[transfer->sender];
+
+    // Only the first chunk of a first request is a clean round trip sample
+    if(transfer->received == 0 && transfer->retries == 0)
+    {
+        double sample = now - transfer->requested;
+        if(link.smoothedRtt == 0)
+        {
+            link.smoothedRtt = sample;
+            link.rttVariance = sample / 2;
+        }
+        else
+        {
+            link.rttVariance = 0.75 * link.rttVariance + 0.25 * qAbs(link.smoothedRtt - sample);
+            link.smoothedRtt = 0.875 * link.smoothedRtt + 0.125 * sample;
+        }
+    }
+
+    // Chunks received again after a retry do not count against the window twice
+    link.inFlight -= qBound((qint64)0, transfer->size - transfer->received, length);
+    transfer->received += length;
+    transfer->end = qMax(transfer->end, offset + length);
+    transfer->lastActivity = now;
+    link.lastActivity = now;
+
+    if(link.sampleStart == 0)
+    {
+        link.sampleStart = now;
+        link.sampleBytes = 0;
+        return;
+    }
+    link.sampleBytes += length;
+    qint64 elapsed = now - link.sampleStart;
+    if(elapsed >= qMax((qint64)200, (qint64)link.smoothedRtt))
+    {
+        double rate = (double)link.sampleBytes / elapsed;
+        link.throughput = link.throughput == 0 ? rate : 0.75 * link.throughput + 0.25 * rate;
+        link.sampleStart = now;
+        link.sampleBytes = 0;
+    }
+}
+
+
+void ZSTransferScheduler::finish(QString path)
+{
+    {
+        QMutexLocker locker(&mutex);
+        QHash<QString, Transfer>::iterator transfer = active.find(path);
+        if(transfer == active.end())
+        {
+            return;
+        }
+        release(transfer.value());
+        active.erase(transfer);
+        if(packMembers.contains(path))
+        {
+            foreach(const Transfer &member, packMembers.take(path))
+            {
+                packOf.remove(member.path);
+            }
+        }
+    }
+    dispatch();
+}
+
+
+QString ZSTransferScheduler::getSender(QString path)
+{
+    QMutexLocker locker(&mutex);
+    return active.value(path).sender;
+}
+
+
+int ZSTransferScheduler::getPendingCount()
+{
+    QMutexLocker locker(&mutex);
+    return pending.size();
+}
+
+
+int ZSTransferScheduler::getActiveCount()
+{
+    QMutexLocker locker(&mutex);
+    return active.size();
+}
+
+
+qint64 ZSTransferScheduler::getWindow(QString sender)
+{
+    QMutexLocker locker(&mutex);
+    return windowOf(links.value(sender));
+}
+
+
+int ZSTransferScheduler::priorityOf(QString path, qint64 size, qint64 timestamp)
+{
+    foreach(const QString &priorityPath, priorityPaths)
+    {
+        if(path == priorityPath || path.startsWith(priorityPath + "/"))
+        {
+            return UserPriority;
+        }
+    }
+    if(size <= SMALL_FILE_SIZE)
+    {
+        return SmallFile;
+    }
+    if(QDateTime::currentMSecsSinceEpoch() - timestamp <= RECENT_INTERVAL)
+    {
+        return RecentFile;
+    }
+    return Bulk;
+}
+
+
+void ZSTransferScheduler::removePending(QString path)
+{
+    Transfer transfer = pending.take(path);
+    QHash<QString, QMap<TransferKey, QString> >::iterator queue = queues.find(transfer.sender);
+    if(queue != queues.end())
+    {
+        queue->remove(transfer.key);
+        if(queue->isEmpty())
+        {
+            queues.erase(queue);
+        }
+    }
+}
+
+
+void ZSTransferScheduler::insertPending(Transfer &transfer)
+{
+    transfer.key.sequence = sequence++;
+    pending.insert(transfer.path, transfer);
+    queues[transfer.sender].insert(transfer.key, transfer.path);
+}
+
+
+qint64 ZSTransferScheduler::windowOf(const PeerLink &link)
+{
+    if(link.smoothedRtt == 0 || link.throughput == 0)
+    {
+        return MINIMUM_WINDOW;
+    }
+    // Twice the bandwidth-delay product, so the window keeps growing while the link has room
+    return qBound((qint64)MINIMUM_WINDOW, (qint64)(2 * link.throughput * link.smoothedRtt), (qint64)MAXIMUM_WINDOW);
+}
+
+
+qint64 ZSTransferScheduler::timeoutOf(const PeerLink &link)
+{
+    double rtt = link.smoothedRtt == 0 ? INITIAL_RTT : link.smoothedRtt + 4 * link.rttVariance;
+    return qBound((qint64)MINIMUM_TIMEOUT, (qint64)(4 * rtt), (qint64)STALL_INTERVAL);
+}
+
+
+void ZSTransferScheduler::release(Transfer &transfer)
+{
+    activePerPeer[transfer.sender]--;
+    PeerLink &link = links[transfer.sender];
+    link.inFlight = qMax((qint64)0, link.inFlight - qMax((qint64)0, transfer.size - transfer.received));
+}
+
+
+bool ZSTransferScheduler::takePack(QString sender, QMap<TransferKey, QString> &queue, QMap<TransferKey, QString>::iterator &next, Transfer &pack)
+{
+    // Collects the small files that follow in the queue, they are sorted by size within their class
+    QList<QMap<TransferKey, QString>::iterator> candidates;
+    qint64 packSize = ZSFilePack::HEADER_SIZE;
+    for(QMap<TransferKey, QString>::iterator candidate = next; candidate != queue.end() && candidates.size() < ZSFilePack::MAXIMUM_ENTRIES; ++candidate)
+    {
+        if(active.contains(candidate.value()) || packOf.contains(candidate.value()))
+        {
+            continue;
+        }
+        qint64 size = pending.value(candidate.value()).size;
+        qint64 entrySize = ZSFilePack::entrySize(candidate.value(), size);
+        if(size > ZSFilePack::MAXIMUM_ENTRY_SIZE || packSize + entrySize > ZSFilePack::MAXIMUM_PACK_SIZE)
+        {
+            break;
+        }
+        packSize += entrySize;
+        candidates.append(candidate);
+    }
+    if(candidates.size() < ZSFilePack::MINIMUM_ENTRIES)
+    {
+        return false;
+    }
+
+    QStringList paths;
+    QList<ZSPackEntry> entries;
+    QList<Transfer> members;
+    foreach(QMap<TransferKey, QString>::iterator candidate, candidates)
+    {
+        Transfer member = pending.take(candidate.value());
+        queue.erase(candidate);
+        ZSPackEntry entry;
+        entry.path = member.path;
+        entry.size = member.size;
+        entry.checksum = member.checksum;
+        paths.append(member.path);
+        entries.append(entry);
+        members.append(member);
+    }
+    next = queue.begin();
+
+    pack.sender = sender;
+    pack.path = ZSFilePack::packPath(paths);
+    pack.size = packSize;
+    pack.checksum = 0;
+    pack.timestamp = QDateTime::currentMSecsSinceEpoch();
+    pack.enqueued = pack.timestamp;
+    pack.retries = 0;
+    pack.key = members.first().key;
+    foreach(const QString &path, paths)
+    {
+        packOf.insert(path, pack.path);
+    }
+    packMembers.insert(pack.path, members);
+    filePack->expectPack(pack.path, entries);
+    return true;
+}
+
+
+void ZSTransferScheduler::slotMaintain()
+{
+    {
+        QMutexLocker locker(&mutex);
+        priorityPaths = ZSSettings::getInstance()->getPriorityPaths();
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+        // Files that waited for long move up to the small files
+        QList<Transfer> promoted;
+        foreach(const Transfer &transfer, pending)
+        {
+            int priority = priorityOf(transfer.path, transfer.size, transfer.timestamp);
+            if(priority > SmallFile && now - transfer.enqueued > STARVATION_INTERVAL)
+            {
+                priority = SmallFile;
+            }
+            if(priority != transfer.key.priority)
+            {
+                promoted.append(transfer);
+                promoted.last().key.priority = priority;
+            }
+        }
+        foreach(Transfer transfer, promoted)
+        {
+            removePending(transfer.path);
+            insertPending(transfer);
+        }
+    }
+    dispatch();
+}
+
+
+void ZSTransferScheduler::slotCheckTimeouts()
+{
+    bool retried = false;
+    {
+        QMutexLocker locker(&mutex);
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+        // A transfer without chunks for a few round trips lost some, what it received is kept
+        QMutableHashIterator<QString, Transfer> transfer(active);
+        while(transfer.hasNext())
+        {
+            transfer.next();
+            PeerLink link = links.value(transfer.value().sender);
+            qint64 timeout;
+            qint64 lastActivity;
+            if(transfer.value().end >= transfer.value().size)
+            {
+                // The end of the file arrived but not all of it, nothing else is coming
+                timeout = qMax((qint64)(2 * link.smoothedRtt), (qint64)INITIAL_RTT);
+                lastActivity = transfer.value().lastActivity;
+            }
+            else
+            {
+                // Backs off with every retry, a busy sender is not flooded with requests
+                timeout = qMin(timeoutOf(link) << transfer.value().retries, (qint64)STALL_INTERVAL);
+                // A peer serves its requests one after another, files queued behind the one
+                // it is sending are not stalled while its chunks keep coming
+                lastActivity = qMax(transfer.value().lastActivity, link.lastActivity);
+            }
+            if(now - lastActivity <= timeout)
+            {
+                continue;
+            }
+
+            Transfer stalled = transfer.value();
+            transfer.remove();
+            release(stalled);
+            retried = true;
+            if(packMembers.contains(stalled.path))
+            {
+                // The files of a pack are queued again one by one, they may be packed differently next time
+                filePack->abort(stalled.path);
+                foreach(Transfer member, packMembers.take(stalled.path))
+                {
+                    packOf.remove(member.path);
+                    if(!pending.contains(member.path) && member.retries < MAXIMUM_RETRIES)
+                    {
+                        member.retries++;
+                        insertPending(member);
+                    }
+                }
+                continue;
+            }
+            stagingArea->suspend(stalled.path);
+            if(pending.contains(stalled.path))
+            {
+                // A newer update of the file is queued already
+                continue;
+            }
+            if(stalled.retries < MAXIMUM_RETRIES)
+            {
+                stalled.retries++;
+                insertPending(stalled);
+            }
+            else
+            {
+                qDebug() << "Error - ZSTransferScheduler::slotCheckTimeouts() failed: Transfer of" << stalled.path << "stalled";
+            }
+        }
+    }
+    if(retried)
+    {
+        dispatch();
+    }
+}
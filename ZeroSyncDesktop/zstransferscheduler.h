@@ -0,0 +1,223 @@
+/* =========================================================================
+   ZSTransferScheduler - Plans which files are received next
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSTRANSFERSCHEDULER_H
+#define ZSTRANSFERSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QThread>
+#include <QStringList>
+#include <QTimer>
+#include <QDateTime>
+#include <QtDebug>
+#include <czmq.h>
+#include <zsync.h>
+#include "zssettings.h"
+#include "zsstagingarea.h"
+#include "zsfilepack.h"
+
+
+//!  Class that schedules the files received from peers
+/*!
+  Files announced by a peer are not requested all at once. They are queued in
+  priority classes: paths the user marked as important first, then small files,
+  then recently modified ones and everything else last; inside a class smaller
+  files go first. Only a configurable number of files is requested from a peer at
+  the same time, the next ones are requested as transfers finish, so a large file
+  never holds back the working documents announced with it. A newer update of a
+  queued file replaces the queued one, and files that waited for long are promoted
+  so large files are not starved.
+
+  The chunks themselves are paced by the agent, so the scheduler controls how many
+  bytes are outstanding at a peer. It measures the time until the first chunk of a
+  request arrives and the rate the chunks arrive with, and keeps about twice the
+  bandwidth-delay product of the peer in flight, spread over more files than the
+  configured number if they are small. A transfer that stops receiving chunks for a
+  few round trips is requested again and resumes from its staging file, so a lost
+  chunk costs a retry of one file instead of the slot for minutes.
+
+  If enabled in the settings, small files that are queued together are requested
+  as one pack through ZSFilePack instead of one by one.
+*/
+class ZSTransferScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint64 SMALL_FILE_SIZE = 1024 * 1024;
+    static const qint64 RECENT_INTERVAL = 24 * 60 * 60 * 1000;
+    static const qint64 STARVATION_INTERVAL = 5 * 60 * 1000;
+    static const qint64 STALL_INTERVAL = 2 * 60 * 1000;
+    static const qint64 INITIAL_RTT = 500;
+    static const qint64 MINIMUM_TIMEOUT = 3000;
+    static const qint64 MINIMUM_WINDOW = 4 * 1024 * 1024;
+    static const qint64 MAXIMUM_WINDOW = 512 * 1024 * 1024;
+    static const int MAXIMUM_TRANSFERS_PER_PEER = 64;
+    static const int MAXIMUM_RETRIES = 3;
+
+    enum Priority
+    {
+        UserPriority = 0,
+        SmallFile = 1,
+        RecentFile = 2,
+        Bulk = 3
+    };
+
+    //!  Constructor
+    /*!
+      Requests are sent through the agent, the staging area and the file pack are told
+      which files to expect.
+    */
+    explicit ZSTransferScheduler(zsync_agent_t *agent, ZSStagingArea *stagingArea, ZSFilePack *filePack, QObject *parent = 0);
+
+    //!  Enqueue-Method
+    /*!
+      Queues a file announced by the sender, replacing a queued older update of the path.
+    */
+    void enqueue(QString sender, QString path, qint64 size, quint64 checksum, qint64 timestamp);
+
+    //!  Dispatch-Method
+    /*!
+      Requests the next files of every peer with free transfer slots. The requests are
+      sent from the thread of the scheduler, the agent is not used from other threads.
+    */
+    void dispatch();
+
+    //!  Progress-Method
+    /*!
+      Notes that length bytes of the path arrived at offset, which updates the
+      round trip and throughput estimates of the sender.
+    */
+    void progress(QString path, qint64 offset, qint64 length);
+
+    //!  Finish-Method
+    /*!
+      Frees the slot of the path, after it was committed or failed, and requests the next file.
+    */
+    void finish(QString path);
+
+    //!  GetSender-Method
+    /*!
+      Returns the peer the path is received from, an empty string if it is not in flight.
+    */
+    QString getSender(QString path);
+
+    int getPendingCount();
+    int getActiveCount();
+
+    //!  GetWindow-Method
+    /*!
+      Returns the bytes the sender may have in flight.
+    */
+    qint64 getWindow(QString sender);
+
+private:
+    struct TransferKey
+    {
+        int priority;
+        qint64 size;
+        quint64 sequence;
+
+        bool operator<(const TransferKey &other) const
+        {
+            if(priority != other.priority)
+                return priority < other.priority;
+            if(size != other.size)
+                return size < other.size;
+            return sequence < other.sequence;
+        }
+    };
+
+    struct Transfer
+    {
+        QString sender;
+        QString path;
+        qint64 size;
+        quint64 checksum;
+        qint64 timestamp;
+        qint64 enqueued;
+        qint64 lastActivity;
+        qint64 requested;
+        qint64 received;
+        qint64 end;
+        int retries;
+        TransferKey key;
+    };
+
+    //!  Round trip and throughput estimates of a peer
+    struct PeerLink
+    {
+        double smoothedRtt;
+        double rttVariance;
+        double throughput;
+        qint64 sampleStart;
+        qint64 sampleBytes;
+        qint64 inFlight;
+        qint64 lastActivity;    // Last chunk of any transfer from the peer
+
+        PeerLink() : smoothedRtt(0), rttVariance(0), throughput(0), sampleStart(0), sampleBytes(0), inFlight(0), lastActivity(0) {}
+    };
+
+    zsync_agent_t *agent;
+    ZSStagingArea *stagingArea;
+    ZSFilePack *filePack;
+    QMutex mutex;
+    QAtomicInt dispatchQueued;
+    QTimer *timer;
+    QTimer *timeoutTimer;
+    quint64 sequence;
+    QStringList priorityPaths;
+
+    QHash<QString, Transfer> pending;
+    QHash<QString, QMap<TransferKey, QString> > queues;
+    QHash<QString, Transfer> active;
+    QHash<QString, int> activePerPeer;
+    QHash<QString, PeerLink> links;
+
+    //!  Files of the packs in flight by pack path, and the pack of every such file
+    QHash<QString, QList<Transfer> > packMembers;
+    QHash<QString, QString> packOf;
+
+    int priorityOf(QString path, qint64 size, qint64 timestamp);
+    void removePending(QString path);
+    void insertPending(Transfer &transfer);
+    qint64 windowOf(const PeerLink &link);
+    qint64 timeoutOf(const PeerLink &link);
+    void release(Transfer &transfer);
+    bool takePack(QString sender, QMap<TransferKey, QString> &queue, QMap<TransferKey, QString>::iterator &next, Transfer &pack);
+
+private slots:
+    void slotDispatch();
+    void slotMaintain();
+    void slotCheckTimeouts();
+};
+
+#endif // ZSTRANSFERSCHEDULER_H
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Multi-peer harness, runs isolated instances of the client on one host
+#
+#-------------------------------------------------
+
+QT       += core sql
+
+QT       -= gui
+
+TARGET = ZeroSyncHarness
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += main.cpp \
+    zspeerprocess.cpp \
+    zssyncharness.cpp
+
+HEADERS  += zspeerprocess.h \
+    zssyncharness.h
+
+QMAKE_CXXFLAGS += -std=c++11
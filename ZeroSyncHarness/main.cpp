@@ -0,0 +1,90 @@
+/* =========================================================================
+   Main - Process entry point for the ZeroSync desktop client
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zssyncharness.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QDir>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("ZeroSyncHarness");
+    a.setOrganizationName("ZeroSyncTeam");
+    a.setOrganizationDomain("zerosync.org");
+    a.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("ZeroSync multi-peer sync harness");
+    parser.addHelpOption();
+    QCommandLineOption peersOption("peers", "Number of peers, e.g. 3, 10 or 30.", "count", "3");
+    QCommandLineOption clientOption("client", "Path to the ZeroSync client binary.", "path", "ZeroSyncDesktop");
+    QCommandLineOption workloadOption("workload", "File with the workload script, the built-in workload is used otherwise.", "path");
+    QCommandLineOption interfaceOption("interface", "Network interface used by the peers, loopback by default.", "name");
+    QCommandLineOption intervalOption("sync-interval", "Sync interval of the peers in milliseconds.", "ms", "1000");
+    QCommandLineOption timeoutOption("timeout", "Seconds to wait for convergence after a step.", "seconds", "120");
+    QCommandLineOption seedOption("seed", "Seed of the written file contents.", "number", "1");
+    QCommandLineOption directoryOption("directory", "Keep the peers in this directory instead of a temporary one.", "path");
+    parser.addOption(peersOption);
+    parser.addOption(clientOption);
+    parser.addOption(workloadOption);
+    parser.addOption(interfaceOption);
+    parser.addOption(intervalOption);
+    parser.addOption(timeoutOption);
+    parser.addOption(seedOption);
+    parser.addOption(directoryOption);
+    parser.process(a);
+
+    QTextStream out(stdout);
+    QTemporaryDir temporaryDirectory;
+    QString baseDirectory = parser.isSet(directoryOption) ? QDir(parser.value(directoryOption)).absolutePath() : temporaryDirectory.path();
+    if(!QDir().mkpath(baseDirectory) || !QDir(baseDirectory).entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty())
+    {
+        out << "Directory " << baseDirectory << " has to be empty\n";
+        return 1;
+    }
+    if(parser.value(peersOption).toInt() < 2)
+    {
+        out << "At least two peers are needed\n";
+        return 1;
+    }
+
+    ZSSyncHarness harness(0, baseDirectory, parser.value(peersOption).toInt());
+    harness.setClient(parser.value(clientOption));
+    harness.setInterface(parser.value(interfaceOption));
+    harness.setSyncInterval(parser.value(intervalOption).toInt());
+    harness.setTimeout(parser.value(timeoutOption).toInt());
+    harness.setSeed(parser.value(seedOption).toULongLong());
+    if(parser.isSet(workloadOption) && !harness.loadWorkload(parser.value(workloadOption)))
+    {
+        return 1;
+    }
+    harness.run();
+    harness.printReport(out);
+    return harness.passed() ? 0 : 1;
+}
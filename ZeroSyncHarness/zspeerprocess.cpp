@@ -0,0 +1,248 @@
+/* =========================================================================
+   ZSPeerProcess - One isolated client instance of the harness
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zspeerprocess.h"
+
+#include <unistd.h>
+
+ZSPeerProcess::ZSPeerProcess(QObject *parent, int number, QString baseDirectory) :
+    QObject(parent),
+    number(number),
+    peerDirectory(QString("%1/peer-%2").arg(baseDirectory).arg(number)),
+    process(0),
+    syncInterval(0)
+{
+}
+
+
+ZSPeerProcess::~ZSPeerProcess()
+{
+    stop();
+}
+
+
+bool ZSPeerProcess::start(QString program, QString interface, int syncInterval)
+{
+    this->program = program;
+    this->interface = interface;
+    this->syncInterval = syncInterval;
+    QDir().mkpath(getSyncDirectory());
+    QDir().mkpath(peerDirectory + "/config");
+    QDir().mkpath(peerDirectory + "/data");
+
+    // Same file the client opens through QSettings with its organization and application name
+    QSettings settings(peerDirectory + "/config/ZeroSyncTeam/ZeroSync.conf", QSettings::IniFormat);
+    settings.setValue("directory", getSyncDirectory());
+    settings.setValue("syncinterval", syncInterval);
+    settings.sync();
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert("HOME", peerDirectory);
+    environment.insert("XDG_CONFIG_HOME", peerDirectory + "/config");
+    environment.insert("XDG_DATA_HOME", peerDirectory + "/data");
+    if(!interface.isEmpty())
+    {
+        environment.insert("ZSYS_INTERFACE", interface);
+    }
+
+    delete process;
+    process = new QProcess(this);
+    process->setProcessEnvironment(environment);
+    process->setWorkingDirectory(peerDirectory);
+    process->setStandardInputFile(QProcess::nullDevice());
+    process->setStandardOutputFile(peerDirectory + "/client.log");
+    process->setStandardErrorFile(peerDirectory + "/client.log", QIODevice::Append);
+    process->start(program, QStringList() << "-c");
+    if(!process->waitForStarted())
+    {
+        qDebug() << "Error - ZSPeerProcess::start() failed for peer" << number << ":" << process->errorString();
+        return false;
+    }
+    return true;
+}
+
+
+void ZSPeerProcess::stop()
+{
+    if(process && process->state() != QProcess::NotRunning)
+    {
+        // The console client quits its event loop on SIGTERM, aboutToQuit then records the clean shutdown
+        process->terminate();
+        if(!process->waitForFinished(10000))
+        {
+            process->kill();
+            process->waitForFinished();
+        }
+    }
+}
+
+
+bool ZSPeerProcess::restart()
+{
+    stop();
+    return start(program, interface, syncInterval);
+}
+
+
+ZSPeerProcess::ScanPath ZSPeerProcess::waitForStartupScan(int seconds)
+{
+    // The log is truncated on every start, so it only holds the scan of the running client
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < seconds * 1000)
+    {
+        QFile log(peerDirectory + "/client.log");
+        if(log.open(QFile::ReadOnly))
+        {
+            QByteArray content = log.readAll();
+            if(content.contains("setFilesToWatch(): Warm start read"))
+            {
+                return WarmScan;
+            }
+            if(content.contains("setFilesToWatch(): Full scan read"))
+            {
+                return FullScan;
+            }
+        }
+        QThread::msleep(100);
+    }
+    return UnknownScan;
+}
+
+
+bool ZSPeerProcess::isRunning()
+{
+    return process && process->state() == QProcess::Running;
+}
+
+
+int ZSPeerProcess::getNumber()
+{
+    return number;
+}
+
+
+QString ZSPeerProcess::getSyncDirectory()
+{
+    return peerDirectory + "/sync";
+}
+
+
+qint64 ZSPeerProcess::getCpuTime()
+{
+    if(!isRunning())
+    {
+        return 0;
+    }
+    QFile stat(QString("/proc/%1/stat").arg(process->processId()));
+    if(!stat.open(QFile::ReadOnly))
+    {
+        return 0;
+    }
+    // The command name may contain spaces, the fields are counted after its closing parenthesis
+    QByteArray line = stat.readAll();
+    QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if(fields.size() < 13)
+    {
+        return 0;
+    }
+    qint64 ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+    return ticks * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+
+QMap<QString, QByteArray> ZSPeerProcess::getManifest()
+{
+    QMap<QString, QByteArray> manifest;
+    QString syncDirectory = getSyncDirectory();
+    QDirIterator iterator(syncDirectory, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while(iterator.hasNext())
+    {
+        QString path = iterator.next().mid(syncDirectory.length() + 1);
+        if(path.startsWith('.') || path.contains("/."))
+        {
+            continue;
+        }
+        QFile file(iterator.filePath());
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        if(file.open(QFile::ReadOnly))
+        {
+            hash.addData(&file);
+        }
+        manifest.insert(path, hash.result());
+    }
+    return manifest;
+}
+
+
+QMap<QString, qint64> ZSPeerProcess::getListing()
+{
+    QMap<QString, qint64> listing;
+    QString syncDirectory = getSyncDirectory();
+    QDirIterator iterator(syncDirectory, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while(iterator.hasNext())
+    {
+        QString path = iterator.next().mid(syncDirectory.length() + 1);
+        if(!path.startsWith('.') && !path.contains("/."))
+        {
+            listing.insert(path, iterator.fileInfo().size());
+        }
+    }
+    return listing;
+}
+
+
+int ZSPeerProcess::countIndexEntries(QString path, bool changedSelf)
+{
+    int count = -1;
+    QString connectionName = QString("peer-%1").arg(number);
+    {
+        // Same path the client takes from QStandardPaths::DataLocation
+        QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        database.setDatabaseName(peerDirectory + "/data/ZeroSyncTeam/ZeroSync/zsdatabase.sqlite");
+        database.setConnectOptions("QSQLITE_OPEN_READONLY");
+        if(database.open())
+        {
+            QSqlQuery query(database);
+            query.prepare("SELECT COUNT(*) FROM fileindex WHERE path = :path AND changed_self = :changed_self");
+            query.bindValue(":path", path);
+            query.bindValue(":changed_self", changedSelf ? 1 : 0);
+            if(query.exec() && query.next())
+            {
+                count = query.value(0).toInt();
+            }
+            else
+            {
+                qDebug() << "Error - ZSPeerProcess::countIndexEntries() failed to execute query: " << query.lastError().text();
+            }
+        }
+        else
+        {
+            qDebug() << "Error - ZSPeerProcess::countIndexEntries() failed: " << database.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return count;
+}
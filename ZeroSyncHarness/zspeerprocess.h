@@ -0,0 +1,141 @@
+/* =========================================================================
+   ZSPeerProcess - One isolated client instance of the harness
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSPEERPROCESS_H
+#define ZSPEERPROCESS_H
+
+#include <QObject>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QSettings>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QMap>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtDebug>
+
+
+//!  Class that runs one isolated instance of the client
+/*!
+  The client keeps its database, its settings and its agent in process wide
+  singletons, so every peer runs as a process of its own. HOME and the XDG
+  directories of the process point into the directory of the peer, which gives it
+  its own settings, database and sync directory. The settings are written before
+  the start, so the console client starts without asking.
+*/
+class ZSPeerProcess : public QObject
+{
+    Q_OBJECT
+
+public:
+    //!  Constructor
+    /*!
+      The peer lives in the directory peer-<number> below baseDirectory.
+    */
+    explicit ZSPeerProcess(QObject *parent = 0, int number = 0, QString baseDirectory = QString());
+
+    //!  Destructor
+    /*!
+      Stops the process.
+    */
+    ~ZSPeerProcess();
+
+    //!  Start-Method
+    /*!
+      Starts the client in console mode. The interface is handed to czmq for the
+      discovery of the other peers, the default interface is used if it is empty.
+    */
+    bool start(QString program, QString interface, int syncInterval);
+    void stop();
+    bool isRunning();
+
+    //!  Restart-Method
+    /*!
+      Stops the client and starts it again with the arguments of the last start.
+    */
+    bool restart();
+
+    //!  Scan path of a client start
+    enum ScanPath
+    {
+        UnknownScan,
+        WarmScan,
+        FullScan
+    };
+
+    //!  WaitForStartupScan-Method
+    /*!
+      Waits until the log of the client shows how the start scanned the sync directory,
+      UnknownScan is returned if neither scan finished before the timeout.
+    */
+    ScanPath waitForStartupScan(int seconds);
+
+    int getNumber();
+    QString getSyncDirectory();
+
+    //!  GetCpuTime-Method
+    /*!
+      Returns the user and system CPU time of the process in milliseconds.
+    */
+    qint64 getCpuTime();
+
+    //!  GetManifest-Method
+    /*!
+      Returns the MD5 of every file in the sync directory by relative path. Hidden
+      entries are skipped like the client does.
+    */
+    QMap<QString, QByteArray> getManifest();
+
+    //!  GetListing-Method
+    /*!
+      Returns the size of every file by relative path, a cheap check before the manifest.
+    */
+    QMap<QString, qint64> getListing();
+
+    //!  CountIndexEntries-Method
+    /*!
+      Returns the number of entries of the path in the index of the client, either
+      the ones it announces or the changed_self ones it keeps to itself. Returns -1
+      if the database of the client can not be read.
+    */
+    int countIndexEntries(QString path, bool changedSelf);
+
+private:
+    int number;
+    QString peerDirectory;
+    QProcess *process;
+    QString program;
+    QString interface;
+    int syncInterval;
+};
+
+#endif // ZSPEERPROCESS_H
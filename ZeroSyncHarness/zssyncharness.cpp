@@ -0,0 +1,452 @@
+/* =========================================================================
+   ZSSyncHarness - Drives a workload through several peers and measures convergence
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#include "zssyncharness.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QFileInfo>
+#include <random>
+
+static const int POLL_INTERVAL = 250;
+static const qint64 WRITE_BLOCK = 1024 * 1024;
+
+ZSSyncHarness::ZSSyncHarness(QObject *parent, QString baseDirectory, int peerCount) :
+    QObject(parent),
+    baseDirectory(baseDirectory),
+    peerCount(peerCount),
+    program("ZeroSyncDesktop"),
+    interface(),
+    syncInterval(1000),
+    timeout(120),
+    seed(1)
+{
+    setWorkload(defaultWorkload());
+}
+
+
+ZSSyncHarness::~ZSSyncHarness()
+{
+    qDeleteAll(peers);
+}
+
+
+void ZSSyncHarness::setClient(QString program)
+{
+    this->program = program;
+}
+
+
+void ZSSyncHarness::setInterface(QString interface)
+{
+    this->interface = interface;
+}
+
+
+void ZSSyncHarness::setSyncInterval(int milliseconds)
+{
+    syncInterval = milliseconds;
+}
+
+
+void ZSSyncHarness::setTimeout(int seconds)
+{
+    timeout = seconds;
+}
+
+
+void ZSSyncHarness::setSeed(quint64 seed)
+{
+    this->seed = seed;
+}
+
+
+void ZSSyncHarness::setWorkload(QStringList lines)
+{
+    steps.clear();
+    QStringList step;
+    foreach(QString line, lines)
+    {
+        line = line.trimmed();
+        if(line.isEmpty() || line.startsWith('#'))
+        {
+            continue;
+        }
+        if(line == "wait")
+        {
+            if(!step.isEmpty())
+            {
+                steps.append(step);
+                step.clear();
+            }
+            continue;
+        }
+        step.append(line);
+    }
+    if(!step.isEmpty())
+    {
+        steps.append(step);
+    }
+}
+
+
+bool ZSSyncHarness::loadWorkload(QString path)
+{
+    QFile file(path);
+    if(!file.open(QFile::ReadOnly | QFile::Text))
+    {
+        qDebug() << "Error - ZSSyncHarness::loadWorkload() failed to open" << path;
+        return false;
+    }
+    setWorkload(QString::fromUtf8(file.readAll()).split('\n'));
+    return true;
+}
+
+
+QStringList ZSSyncHarness::defaultWorkload()
+{
+    return QStringList()
+            << "0 create documents/notes.txt 4096"
+            << "1 create documents/report.bin 1048576"
+            << "2 create media/video.bin 33554432"
+            << "wait"
+            << "1 received documents/notes.txt"
+            << "0 modify documents/report.bin"
+            << "1 append media/video.bin 65536"
+            << "wait"
+            << "2 rename documents/notes.txt documents/archive.txt"
+            << "wait"
+            << "0 delete documents/archive.txt"
+            << "1 delete documents/report.bin"
+            << "wait"
+            << "0 restart"
+            << "1 create documents/restarted.txt 4096"
+            << "wait";
+}
+
+
+bool ZSSyncHarness::run()
+{
+    results.clear();
+    qDeleteAll(peers);
+    peers.clear();
+
+    QTextStream out(stdout);
+    out << "Starting " << peerCount << " peers in " << baseDirectory << "\n";
+    out.flush();
+    for(int i = 0; i < peerCount; i++)
+    {
+        ZSPeerProcess *peer = new ZSPeerProcess(this, i, baseDirectory);
+        peers.append(peer);
+        if(!peer->start(program, interface, syncInterval))
+        {
+            return false;
+        }
+    }
+
+    int number = 0;
+    foreach(QStringList step, steps)
+    {
+        ZSHarnessStep result;
+        result.actions = step;
+        result.failedActions = 0;
+
+        QList<qint64> cpuBefore = getCpuTimes();
+        qint64 bytesBefore = getInterfaceBytes();
+        foreach(QString line, step)
+        {
+            if(!executeAction(line, number++))
+            {
+                qDebug() << "Error - ZSSyncHarness::run() failed on" << line;
+                result.failedActions++;
+            }
+        }
+        result.converged = waitForConvergence(result.convergenceTime);
+        result.wireBytes = getInterfaceBytes() - bytesBefore;
+
+        QList<qint64> cpuAfter = getCpuTimes();
+        qint64 total = 0;
+        result.minimumCpuTime = -1;
+        result.maximumCpuTime = 0;
+        for(int i = 0; i < peerCount; i++)
+        {
+            qint64 cpu = cpuAfter.at(i) - cpuBefore.at(i);
+            if(cpu < 0)
+            {
+                // The peer was restarted during the step, only its new process is counted
+                cpu = cpuAfter.at(i);
+            }
+            total += cpu;
+            result.minimumCpuTime = result.minimumCpuTime < 0 ? cpu : qMin(result.minimumCpuTime, cpu);
+            result.maximumCpuTime = qMax(result.maximumCpuTime, cpu);
+        }
+        result.averageCpuTime = peerCount > 0 ? total / peerCount : 0;
+        results.append(result);
+
+        out << "Step " << results.size() << (result.converged ? " converged after " : " timed out after ")
+            << result.convergenceTime << " ms\n";
+        out.flush();
+    }
+
+    foreach(ZSPeerProcess *peer, peers)
+    {
+        peer->stop();
+    }
+    return passed();
+}
+
+
+bool ZSSyncHarness::executeAction(QString line, int number)
+{
+    QStringList arguments = line.split(' ', QString::SkipEmptyParts);
+    if(arguments.size() < 2)
+    {
+        return false;
+    }
+    int peer = arguments.at(0).toInt() % peerCount;
+    QString action = arguments.at(1);
+    if(action == "restart" && arguments.size() == 2)
+    {
+        // The peer was stopped cleanly, so it has to skip the directories that did not change
+        if(!peers.at(peer)->restart())
+        {
+            return false;
+        }
+        ZSPeerProcess::ScanPath scanPath = peers.at(peer)->waitForStartupScan(timeout);
+        if(scanPath != ZSPeerProcess::WarmScan)
+        {
+            qDebug() << "Error - ZSSyncHarness::executeAction() failed: Peer" << peer << (scanPath == ZSPeerProcess::FullScan ? "took the full scan path after a restart" : "did not finish its startup scan");
+            return false;
+        }
+        return true;
+    }
+    if(arguments.size() < 3)
+    {
+        return false;
+    }
+    QDir directory(peers.at(peer)->getSyncDirectory());
+    QString path = directory.filePath(arguments.at(2));
+    quint64 contentSeed = seed * 1000003 + number;
+
+    if(action == "create" && arguments.size() == 4)
+    {
+        QDir().mkpath(QFileInfo(path).absolutePath());
+        return writeContent(path, 0, arguments.at(3).toLongLong(), contentSeed);
+    }
+    else if(action == "modify")
+    {
+        // Rewrites a block in the middle, so the size stays the same
+        qint64 size = QFileInfo(path).size();
+        qint64 length = qMin(size, (qint64)4096);
+        return writeContent(path, (size - length) / 2, length, contentSeed);
+    }
+    else if(action == "append" && arguments.size() == 4)
+    {
+        return writeContent(path, QFileInfo(path).size(), arguments.at(3).toLongLong(), contentSeed);
+    }
+    else if(action == "rename" && arguments.size() == 4)
+    {
+        QString newPath = directory.filePath(arguments.at(3));
+        QDir().mkpath(QFileInfo(newPath).absolutePath());
+        return QFile::rename(path, newPath);
+    }
+    else if(action == "delete")
+    {
+        return QFile::remove(path);
+    }
+    else if(action == "received")
+    {
+        return checkReceived(peers.at(peer), arguments.at(2));
+    }
+    return false;
+}
+
+
+bool ZSSyncHarness::checkReceived(ZSPeerProcess *peer, QString path)
+{
+    // The watcher records the file once it settled, which may be after the step converged
+    QElapsedTimer timer;
+    timer.start();
+    while(peer->countIndexEntries(path, true) <= 0)
+    {
+        if(timer.elapsed() >= timeout * 1000)
+        {
+            qDebug() << "Error - ZSSyncHarness::checkReceived() failed: Peer" << peer->getNumber() << "never recorded" << path;
+            return false;
+        }
+        QCoreApplication::processEvents();
+        QThread::msleep(POLL_INTERVAL);
+    }
+    int announced = peer->countIndexEntries(path, false);
+    if(announced != 0)
+    {
+        qDebug() << "Error - ZSSyncHarness::checkReceived() failed: Peer" << peer->getNumber() << "announced the received" << path << announced << "times";
+        return false;
+    }
+    return true;
+}
+
+
+bool ZSSyncHarness::writeContent(QString path, qint64 offset, qint64 size, quint64 seed)
+{
+    QFile file(path);
+    if(!file.open(QFile::ReadWrite) || !file.seek(offset))
+    {
+        return false;
+    }
+    std::mt19937_64 generator(seed);
+    QByteArray block;
+    while(size > 0)
+    {
+        block.resize(qMin(size, WRITE_BLOCK) & ~7);
+        for(int i = 0; i < block.size(); i += 8)
+        {
+            quint64 value = generator();
+            memcpy(block.data() + i, &value, 8);
+        }
+        // Sizes that are not a multiple of eight end with the first bytes of one more value
+        if(block.size() < qMin(size, WRITE_BLOCK))
+        {
+            quint64 value = generator();
+            block.append((const char*)&value, qMin(size, WRITE_BLOCK) - block.size());
+        }
+        if(file.write(block) != block.size())
+        {
+            return false;
+        }
+        size -= block.size();
+    }
+    return true;
+}
+
+
+bool ZSSyncHarness::waitForConvergence(qint64 &elapsed)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < timeout * 1000)
+    {
+        if(isConverged())
+        {
+            elapsed = timer.elapsed();
+            return true;
+        }
+        QCoreApplication::processEvents();
+        QThread::msleep(POLL_INTERVAL);
+    }
+    elapsed = timer.elapsed();
+    return false;
+}
+
+
+bool ZSSyncHarness::isConverged()
+{
+    // The listings are compared first, hashing only pays off once every peer has every file
+    QMap<QString, qint64> listing = peers.first()->getListing();
+    for(int i = 1; i < peers.size(); i++)
+    {
+        if(peers.at(i)->getListing() != listing)
+        {
+            return false;
+        }
+    }
+    QMap<QString, QByteArray> manifest = peers.first()->getManifest();
+    for(int i = 1; i < peers.size(); i++)
+    {
+        if(peers.at(i)->getManifest() != manifest)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+qint64 ZSSyncHarness::getInterfaceBytes()
+{
+    // Every peer sends and receives on the same host, the received bytes count every byte once
+    QString name = interface.isEmpty() ? QString("lo") : interface;
+    QFile file("/proc/net/dev");
+    if(!file.open(QFile::ReadOnly | QFile::Text))
+    {
+        return 0;
+    }
+    foreach(QByteArray line, file.readAll().split('\n'))
+    {
+        int colon = line.indexOf(':');
+        if(colon > 0 && line.left(colon).trimmed() == name.toUtf8())
+        {
+            return line.mid(colon + 1).simplified().split(' ').first().toLongLong();
+        }
+    }
+    return 0;
+}
+
+
+QList<qint64> ZSSyncHarness::getCpuTimes()
+{
+    QList<qint64> times;
+    foreach(ZSPeerProcess *peer, peers)
+    {
+        times.append(peer->getCpuTime());
+    }
+    return times;
+}
+
+
+void ZSSyncHarness::printReport(QTextStream &out)
+{
+    out << "\nPeers: " << peerCount << "\n";
+    out << qSetFieldWidth(6) << left << "Step" << qSetFieldWidth(12) << right << "Converged" << "Time ms"
+        << "Failed" << "Wire KB" << "CPU min" << "CPU avg" << "CPU max" << qSetFieldWidth(0) << "\n";
+    for(int i = 0; i < results.size(); i++)
+    {
+        const ZSHarnessStep &result = results.at(i);
+        out << qSetFieldWidth(6) << left << i + 1 << qSetFieldWidth(12) << right
+            << (result.converged ? "yes" : "no") << result.convergenceTime << result.failedActions << result.wireBytes / 1000
+            << result.minimumCpuTime << result.averageCpuTime << result.maximumCpuTime << qSetFieldWidth(0) << "\n";
+        foreach(QString action, result.actions)
+        {
+            out << "      " << action << "\n";
+        }
+    }
+    out.flush();
+}
+
+
+bool ZSSyncHarness::passed()
+{
+    if(results.size() != steps.size())
+    {
+        return false;
+    }
+    foreach(ZSHarnessStep result, results)
+    {
+        if(!result.converged || result.failedActions > 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,124 @@
+/* =========================================================================
+   ZSSyncHarness - Drives a workload through several peers and measures convergence
+
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2014 Tommy Bluhm, Kevin Sapper
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+
+#ifndef ZSSYNCHARNESS_H
+#define ZSSYNCHARNESS_H
+
+#include "zspeerprocess.h"
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QTextStream>
+#include <QElapsedTimer>
+
+//!  Struct with the measurements of one workload step
+struct ZSHarnessStep
+{
+    QStringList actions;
+    int failedActions;
+    bool converged;
+    qint64 convergenceTime;
+    qint64 wireBytes;
+    qint64 minimumCpuTime;
+    qint64 averageCpuTime;
+    qint64 maximumCpuTime;
+};
+
+//!  Class that drives a workload through several peers on one host
+/*!
+  Every line of a workload is "<peer> <action> <arguments>" or "wait". The actions
+  are create <path> <size>, modify <path>, append <path> <size>, rename <path> <newpath>,
+  delete <path>, received <path>, which checks that the peer recorded a file it got
+  from another peer without announcing it again, and restart, which stops the peer
+  and checks that its next start takes the warm start path. The peer number is taken modulo the number of peers, so one
+  workload runs with any number of peers. The actions up to a wait form a step, after
+  a step the harness waits until every peer holds the same files and records the
+  time to convergence, the bytes on the network interface and the CPU time of the peers.
+*/
+class ZSSyncHarness : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ZSSyncHarness(QObject *parent = 0, QString baseDirectory = QString(), int peerCount = 3);
+
+    ~ZSSyncHarness();
+
+    void setClient(QString program);
+    void setInterface(QString interface);
+    void setSyncInterval(int milliseconds);
+    void setTimeout(int seconds);
+    void setSeed(quint64 seed);
+
+    //!  SetWorkload-Method
+    /*!
+      Empty lines and lines starting with '#' are ignored.
+    */
+    void setWorkload(QStringList lines);
+
+    //!  LoadWorkload-Method
+    /*!
+      Reads the workload from a file, returns false if it can not be read.
+    */
+    bool loadWorkload(QString path);
+
+    //!  Run-Method
+    /*!
+      Starts the peers, runs every step and stops the peers again.
+    */
+    bool run();
+
+    void printReport(QTextStream &out);
+
+    //!  Passed-Method
+    /*!
+      True if every action succeeded and every step converged before the timeout.
+    */
+    bool passed();
+
+    static QStringList defaultWorkload();
+
+private:
+    bool executeAction(QString line, int number);
+    bool checkReceived(ZSPeerProcess *peer, QString path);
+    bool waitForConvergence(qint64 &elapsed);
+    bool isConverged();
+    qint64 getInterfaceBytes();
+    QList<qint64> getCpuTimes();
+    bool writeContent(QString path, qint64 offset, qint64 size, quint64 seed);
+
+    QString baseDirectory;
+    int peerCount;
+    QString program;
+    QString interface;
+    int syncInterval;
+    int timeout;
+    quint64 seed;
+    QList<QStringList> steps;
+    QList<ZSPeerProcess*> peers;
+    QList<ZSHarnessStep> results;
+};
+
+#endif // ZSSYNCHARNESS_H